@@ -0,0 +1,80 @@
+#include "addrtables.h"
+
+#include <algorithm>
+
+
+namespace {
+  const std::vector<snd_seq_addr_t> noPorts;
+
+  void removeOne(std::vector<snd_seq_addr_t>& v, const snd_seq_addr_t& a) {
+    // order doesn't matter, so swap the last one into its place
+    auto i = std::find(v.begin(), v.end(), a);
+    if (i == v.end()) return;
+    *i = v.back();
+    v.pop_back();
+  }
+}
+
+
+bool ConnectionGraph::insert(const snd_seq_connect_t& c) {
+  if (!connections.insert(c))
+    return false;
+  edges[c.sender].dests.push_back(c.dest);
+  edges[c.dest].senders.push_back(c.sender);
+  return true;
+}
+
+std::size_t ConnectionGraph::erase(const snd_seq_connect_t& c) {
+  if (!connections.erase(c))
+    return 0;
+  unlink(c.sender, c.dest);
+  return 1;
+}
+
+void ConnectionGraph::unlink(
+  const snd_seq_addr_t& from, const snd_seq_addr_t& to)
+{
+  // Ports with no connections are dropped from the table, so that it
+  // doesn't fill with every port that has come and gone.
+  auto drop = [&](const snd_seq_addr_t& a, auto member, const snd_seq_addr_t& other) {
+    auto i = edges.find(a);
+    if (i == edges.end()) return;
+    auto& e = i->second;
+    removeOne(e.*member, other);
+    if (e.dests.empty() && e.senders.empty())
+      edges.erase(a);
+  };
+  drop(from, &Edges::dests, to);
+  drop(to, &Edges::senders, from);
+}
+
+const std::vector<snd_seq_addr_t>&
+ConnectionGraph::destsOf(const snd_seq_addr_t& a) const {
+  auto i = edges.find(a);
+  return i == edges.end() ? noPorts : i->second.dests;
+}
+
+const std::vector<snd_seq_addr_t>&
+ConnectionGraph::sendersOf(const snd_seq_addr_t& a) const {
+  auto i = edges.find(a);
+  return i == edges.end() ? noPorts : i->second.senders;
+}
+
+ScratchVector<snd_seq_connect_t>
+ConnectionGraph::connectionsOf(const snd_seq_addr_t& a) const {
+  ScratchVector<snd_seq_connect_t> conns;
+  for (auto& d : destsOf(a))
+    conns.push_back({a, d});
+  for (auto& s : sendersOf(a))
+    if (!(s == a))    // a connection to itself is already there
+      conns.push_back({s, a});
+  std::sort(conns.begin(), conns.end());
+  return conns;
+}
+
+std::size_t ConnectionGraph::eraseAllOf(const snd_seq_addr_t& a) {
+  auto conns = connectionsOf(a);
+  for (auto& c : conns)
+    erase(c);
+  return conns.size();
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "seq.h"
+
+
+// Tables of ports and of connections, for the daemon's model of the system.
+//
+// An ALSA address is only two bytes, and a connection four, so rather than
+// a tree node per entry, these keep their entries in flat arrays, keyed by
+// the address or connection packed into an integer.
+
+inline uint16_t packAddr(const snd_seq_addr_t& a) {
+  return static_cast<uint16_t>(a.client << 8 | a.port);
+}
+
+inline uint32_t packConnect(const snd_seq_connect_t& c) {
+  return uint32_t(packAddr(c.sender)) << 16 | packAddr(c.dest);
+}
+
+
+// A map from port address to T, kept sorted by address, so that it iterates
+// in the same order as a std::map would. The packed keys are held apart from
+// the entries, so that a lookup searches a dense array of 16 bit values.
+//
+// Inserting or erasing moves the entries after it: References to entries
+// are only good until the table is next changed.
+
+template <typename T>
+class PortTable {
+  public:
+    using value_type = std::pair<snd_seq_addr_t, T>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    iterator begin()              { return entries.begin(); }
+    iterator end()                { return entries.end(); }
+    const_iterator begin() const  { return entries.begin(); }
+    const_iterator end() const    { return entries.end(); }
+
+    std::size_t size() const      { return entries.size(); }
+    bool empty() const            { return entries.empty(); }
+
+    iterator find(const snd_seq_addr_t& a) {
+      auto k = packAddr(a);
+      auto i = lowerBound(k);
+      return i < keys.size() && keys[i] == k ? begin() + i : end();
+    }
+    const_iterator find(const snd_seq_addr_t& a) const {
+      return const_cast<PortTable*>(this)->find(a);
+    }
+
+    T& operator[](const snd_seq_addr_t& a) {
+      auto k = packAddr(a);
+      auto i = lowerBound(k);
+      if (i == keys.size() || keys[i] != k) {
+        keys.insert(keys.begin() + i, k);
+        entries.insert(entries.begin() + i, value_type(a, T()));
+      }
+      return entries[i].second;
+    }
+
+    std::size_t erase(const snd_seq_addr_t& a) {
+      auto k = packAddr(a);
+      auto i = lowerBound(k);
+      if (i == keys.size() || keys[i] != k)
+        return 0;
+      keys.erase(keys.begin() + i);
+      entries.erase(entries.begin() + i);
+      return 1;
+    }
+
+    // Erases the entries for which pred(entry) is true, keeping the order
+    // of the rest.
+    template <typename Pred>
+    std::size_t eraseIf(Pred pred) {
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < entries.size(); ++i) {
+        if (pred(entries[i]))
+          continue;
+        if (kept != i) {
+          keys[kept] = keys[i];
+          entries[kept] = std::move(entries[i]);
+        }
+        kept += 1;
+      }
+      std::size_t erased = entries.size() - kept;
+      keys.erase(keys.begin() + kept, keys.end());
+      entries.erase(entries.begin() + kept, entries.end());
+      return erased;
+    }
+
+    void reserve(std::size_t n)   { keys.reserve(n); entries.reserve(n); }
+    void clear()                  { keys.clear(); entries.clear(); }
+    void swap(PortTable& other)   { keys.swap(other.keys); entries.swap(other.entries); }
+
+  private:
+    std::vector<uint16_t> keys;
+    std::vector<value_type> entries;
+
+    // The index of the first key not less than k. The loop has no branch
+    // on the comparison, which compiles to a conditional move.
+    std::size_t lowerBound(uint16_t k) const {
+      std::size_t n = keys.size();
+      if (n == 0) return 0;
+      const uint16_t* base = keys.data();
+      while (n > 1) {
+        std::size_t half = n / 2;
+        base = base[half] < k ? base + half : base;
+        n -= half;
+      }
+      return (base - keys.data()) + (*base < k);
+    }
+};
+
+
+// A set of connections, as an open addressing hash table with linear
+// probing. Slots hold the connections themselves; an empty slot holds one
+// between two broadcast addresses, which can never be subscribed.
+//
+// Iteration order is that of the slots, not of the connections. Where the
+// order shows, as in log output, collect and sort them first.
+
+class ConnectionSet {
+  public:
+    class const_iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = snd_seq_connect_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const snd_seq_connect_t*;
+        using reference = const snd_seq_connect_t&;
+
+        const snd_seq_connect_t& operator*() const   { return *slot; }
+        const snd_seq_connect_t* operator->() const  { return slot; }
+        const_iterator& operator++()  { ++slot; skipEmpty(); return *this; }
+        bool operator==(const const_iterator& o) const { return slot == o.slot; }
+        bool operator!=(const const_iterator& o) const { return slot != o.slot; }
+
+      private:
+        friend class ConnectionSet;
+        const_iterator(const snd_seq_connect_t* s, const snd_seq_connect_t* e)
+          : slot(s), stop(e) { skipEmpty(); }
+        void skipEmpty()
+          { while (slot != stop && isEmpty(*slot)) ++slot; }
+
+        const snd_seq_connect_t* slot;
+        const snd_seq_connect_t* stop;
+    };
+
+    const_iterator begin() const
+      { return const_iterator(slots.data(), slots.data() + slots.size()); }
+    const_iterator end() const
+      { auto e = slots.data() + slots.size(); return const_iterator(e, e); }
+
+    std::size_t size() const    { return count; }
+    bool empty() const          { return count == 0; }
+
+    bool has(const snd_seq_connect_t& c) const {
+      if (slots.empty()) return false;
+      auto k = packConnect(c);
+      for (auto i = home(k); ; i = (i + 1) & mask()) {
+        auto s = packConnect(slots[i]);
+        if (s == k) return true;
+        if (s == emptyKey) return false;
+      }
+    }
+
+    bool insert(const snd_seq_connect_t& c) {   // false if already there
+      if ((count + 1) * 2 > slots.size())
+        grow();
+      auto k = packConnect(c);
+      auto i = home(k);
+      for (; ; i = (i + 1) & mask()) {
+        auto s = packConnect(slots[i]);
+        if (s == k) return false;
+        if (s == emptyKey) break;
+      }
+      slots[i] = c;
+      count += 1;
+      return true;
+    }
+
+    std::size_t erase(const snd_seq_connect_t& c) {
+      if (slots.empty()) return 0;
+      auto k = packConnect(c);
+      auto i = home(k);
+      for (; ; i = (i + 1) & mask()) {
+        auto s = packConnect(slots[i]);
+        if (s == k) break;
+        if (s == emptyKey) return 0;
+      }
+
+      // Close the gap, by moving back any later entry in the run whose
+      // home slot is at or before it, so no probe ever stops early.
+      for (auto j = (i + 1) & mask(); !isEmpty(slots[j]); j = (j + 1) & mask()) {
+        auto h = home(packConnect(slots[j]));
+        if (((j - h) & mask()) >= ((j - i) & mask())) {
+          slots[i] = slots[j];
+          i = j;
+        }
+      }
+      slots[i] = emptySlot;
+      count -= 1;
+      return 1;
+    }
+
+    void clear()                      { slots.clear(); count = 0; shift = 32; }
+    void swap(ConnectionSet& other) {
+      slots.swap(other.slots);
+      std::swap(count, other.count);
+      std::swap(shift, other.shift);
+    }
+
+  private:
+    static constexpr uint32_t emptyKey = 0xffffffff;
+    static constexpr snd_seq_connect_t emptySlot = {{0xff, 0xff}, {0xff, 0xff}};
+
+    std::vector<snd_seq_connect_t> slots;   // size is zero or a power of two
+    std::size_t count = 0;
+    int shift = 32;                         // 32 less log2 of the size
+
+    static bool isEmpty(const snd_seq_connect_t& c)
+      { return packConnect(c) == emptyKey; }
+
+    std::size_t mask() const { return slots.size() - 1; }
+
+    // Fibonacci hashing: the high bits of the product are well mixed.
+    std::size_t home(uint32_t k) const { return (k * 0x9e3779b1u) >> shift; }
+
+    void grow() {
+      std::vector<snd_seq_connect_t> old;
+      old.swap(slots);
+      slots.assign(old.empty() ? 16 : old.size() * 2, emptySlot);
+      shift = old.empty() ? 28 : shift - 1;
+      count = 0;
+      for (auto& c : old)
+        if (!isEmpty(c))
+          insert(c);
+    }
+};
+
+
+// The connections, as a ConnectionSet, and also by port: For each port, the
+// ports it sends to and those it receives from. Finding, or dropping, all
+// the connections of a port takes time in proportion to how many it has,
+// rather than to how many there are in all.
+
+class ConnectionGraph {
+  public:
+    using const_iterator = ConnectionSet::const_iterator;
+
+    const_iterator begin() const  { return connections.begin(); }
+    const_iterator end() const    { return connections.end(); }
+
+    std::size_t size() const      { return connections.size(); }
+    bool empty() const            { return connections.empty(); }
+
+    bool has(const snd_seq_connect_t& c) const { return connections.has(c); }
+
+    bool insert(const snd_seq_connect_t&);      // false if already there
+    std::size_t erase(const snd_seq_connect_t&);
+
+    const std::vector<snd_seq_addr_t>& destsOf(const snd_seq_addr_t&) const;
+    const std::vector<snd_seq_addr_t>& sendersOf(const snd_seq_addr_t&) const;
+
+    // all connections to or from the port, in order, in the scratch arena
+    ScratchVector<snd_seq_connect_t> connectionsOf(const snd_seq_addr_t&) const;
+    std::size_t eraseAllOf(const snd_seq_addr_t&);
+
+    void clear()                    { connections.clear(); edges.clear(); }
+    void swap(ConnectionGraph& other) {
+      connections.swap(other.connections);
+      edges.swap(other.edges);
+    }
+
+  private:
+    struct Edges {
+      std::vector<snd_seq_addr_t> dests;
+      std::vector<snd_seq_addr_t> senders;
+    };
+
+    ConnectionSet connections;
+    PortTable<Edges> edges;
+
+    void unlink(const snd_seq_addr_t& from, const snd_seq_addr_t& to);
+};
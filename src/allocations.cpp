@@ -0,0 +1,28 @@
+#include "allocations.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+namespace {
+  std::atomic<unsigned long> allocations{0};
+}
+
+unsigned long Allocations::count() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+
+void* operator new(std::size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+// not inlined, or the compiler sees free() given what new returned
+[[gnu::noinline]] void operator delete(void* p) noexcept
+  { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept
+  { std::free(p); }
@@ -0,0 +1,10 @@
+#pragma once
+
+
+// Linking allocations.cpp into a program replaces the global operator new
+// with one that counts each call, so that code can be checked for how much
+// it allocates from the heap.
+
+namespace Allocations {
+  unsigned long count();    // calls to operator new so far, on any thread
+}
@@ -0,0 +1,61 @@
+#include "arena.h"
+
+#include <new>
+
+
+Arena::Arena(std::size_t initialSize)
+  : block(static_cast<char*>(::operator new(initialSize))), size(initialSize)
+  { }
+
+Arena::~Arena() {
+  reset();
+  ::operator delete(block);
+}
+
+void* Arena::allocate(std::size_t bytes, std::size_t align) {
+  std::size_t start = (used + align - 1) & ~(align - 1);
+  if (start + bytes <= size) {
+    used = start + bytes;
+    if (used > peak) peak = used;
+    return block + start;
+  }
+
+  overflows += 1;
+  spilled += bytes;
+  if (size + spilled > peak) peak = size + spilled;
+  void* p = ::operator new(bytes);
+  spill.push_back(p);
+  return p;
+}
+
+void Arena::deallocate(void* p, std::size_t bytes) {
+  char* c = static_cast<char*>(p);
+  if (c >= block && c < block + size && c + bytes == block + used)
+    used -= bytes;
+  // anything else waits for reset()
+}
+
+void Arena::reset() {
+  resets += 1;
+  used = 0;
+  if (spill.empty())
+    return;
+
+  for (auto p : spill)
+    ::operator delete(p);
+  spill.clear();
+
+  // Make room for all that was needed, so it needn't spill again.
+  std::size_t wanted = size + spilled;
+  spilled = 0;
+  while (size < wanted)
+    size *= 2;
+  ::operator delete(block);
+  block = static_cast<char*>(::operator new(size));
+}
+
+
+Arena& scratchArena() {
+  static Arena arena(64 * 1024);
+  return arena;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+// A monotonic allocator, for temporaries that are all done with at a known
+// point. Allocating bumps a pointer through one block; freeing does nothing,
+// except for the most recent allocation, which is given back so that a
+// growing vector can reuse its own space. reset() then makes the whole block
+// free again, in one step.
+//
+// Should a pass outgrow the block, the excess comes from the heap, and at
+// the next reset() the block is enlarged to hold it all. After the first
+// busy pass or two, nothing more is allocated from the heap.
+
+class Arena {
+  public:
+    explicit Arena(std::size_t initialSize);
+    ~Arena();
+
+    void* allocate(std::size_t bytes, std::size_t align);
+    void deallocate(void* p, std::size_t bytes);
+    void reset();
+
+    std::size_t capacity() const  { return size; }
+    std::size_t highWater() const { return peak; }
+    unsigned long resets = 0;
+    unsigned long overflows = 0;    // allocations that went to the heap
+
+  private:
+    char* block;
+    std::size_t size;
+    std::size_t used = 0;
+    std::size_t peak = 0;
+
+    std::vector<void*> spill;       // overflow allocations, freed by reset()
+    std::size_t spilled = 0;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
+
+
+// The arena for the daemon's handling of events: ALSA Seq announcements,
+// timers, and commands. The event loop resets it after each pass, so
+// whatever is allocated from it must not be kept beyond the handling of
+// the event. It is only for the main thread.
+
+Arena& scratchArena();
+
+template <typename T>
+struct ScratchAllocator {
+  using value_type = T;
+
+  ScratchAllocator() = default;
+  template <typename U> ScratchAllocator(const ScratchAllocator<U>&) { }
+
+  T* allocate(std::size_t n)
+    { return static_cast<T*>(scratchArena().allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T* p, std::size_t n)
+    { scratchArena().deallocate(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const ScratchAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const ScratchAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
@@ -15,6 +15,17 @@ namespace Args {
 
   bool keepObserved = false;
   bool resetHard = false;
+  bool resetMinimal = false;
+
+  bool statusLatency = false;
+
+  int nameWait = 200;
+  int nameRecheck = 10;
+  int subscribeThreads = 0;
+  int checkInterval = 10;
+  bool readerThread = false;
+  int inputEvents = 1000;
+  int saveDelay = 500;
 
   int exitCode = 0;
 
@@ -59,10 +70,13 @@ namespace Args {
     resetApp->add_flag("--keep", keepObserved, "Keep the observed rules");
     resetApp->add_flag("--hard", resetHard, "Reload ALSA state while resetting;"
                                           "\nshould never be needed");
+    resetApp->add_flag("--minimal", resetMinimal, "Only change the connections that differ"
+                                          "\nfrom what the rules want");
 
     CLI::App *statusApp = app.add_subcommand("status", "Report current status of the daemon");
     statusApp->parse_complete_callback([](){ command = Command::Status; });
     statusApp->group(userGroup);
+    statusApp->add_flag("--latency", statusLatency, "Show how long the daemon takes to react");
 
     CLI::App *helpApp = app.add_subcommand("help");
     helpApp->group(userGroup);
@@ -75,6 +89,32 @@ namespace Args {
     CLI::App *daemonApp = app.add_subcommand("daemon", "Run the minder service");
     daemonApp->group(systemGroup);
     daemonApp->parse_complete_callback([](){ command = Command::Daemon; });
+    daemonApp->add_option("--name-wait", nameWait,
+        "Longest to hold the ports of a new client\nthat hasn't set its name yet (200);\n0 doesn't hold them at all")
+      ->option_text("MS")
+      ->check(CLI::Range(0, 10000));
+    daemonApp->add_option("--name-recheck", nameRecheck,
+        "When to first recheck the name of such\na client (10); doubles each recheck")
+      ->option_text("MS")
+      ->check(CLI::Range(1, 10000));
+    daemonApp->add_option("--subscribe-threads", subscribeThreads,
+        "Threads to make connections with (0);\n0 makes them in the main loop")
+      ->option_text("N")
+      ->check(CLI::Range(0, 16));
+    daemonApp->add_option("--check-interval", checkInterval,
+        "How often to check for renamed clients\nand ports (10);\n0 never checks")
+      ->option_text("SECS")
+      ->check(CLI::Range(0, 3600));
+    daemonApp->add_flag("--reader-thread", readerThread,
+        "Read ALSA Seq events on a separate thread");
+    daemonApp->add_option("--input-events", inputEvents,
+        "Room for ALSA Seq events waiting to be\nread (1000)")
+      ->option_text("N")
+      ->check(CLI::Range(200, 2000));
+    daemonApp->add_option("--save-delay", saveDelay,
+        "How long to wait for connections to stop\nchanging before saving them (500);\n0 saves each change at once")
+      ->option_text("MS")
+      ->check(CLI::Range(0, 60000));
 
 
     CLI::App *cltApp = app.add_subcommand("connection-logic-test", "");
@@ -25,6 +25,19 @@ namespace Args {
   // Reset command options
   extern bool keepObserved;
   extern bool resetHard;
+  extern bool resetMinimal;
+
+  // Status command options
+  extern bool statusLatency;
+
+  // Daemon command options
+  extern int nameWait;      // ms to hold ports of a client not yet named
+  extern int nameRecheck;   // ms until first checking the name again
+  extern int subscribeThreads;  // 0 makes connections on the main thread
+  extern int checkInterval; // seconds between topology checks, 0 for none
+  extern bool readerThread; // read ALSA Seq events on a separate thread
+  extern int inputEvents;   // room for ALSA Seq events waiting to be read
+  extern int saveDelay;     // ms of quiet before writing observed rules
 
   extern int exitCode;
   bool parse(int argc, char* argv[]);
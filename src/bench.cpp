@@ -0,0 +1,545 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "addrtables.h"
+#include "allocations.h"
+#include "arena.h"
+#include "connection-logic.h"
+#include "ext/CLI11.hpp"
+#include "msg.h"
+#include "rule.h"
+#include "rulematch.h"
+#include "seqsnapshot.h"
+
+
+// Times the daemon's connection logic against synthetic systems of ports:
+// N clients, each with M ports, and a profile of K rules. Nothing here uses
+// ALSA; the ports exist only in SyntheticSystem below.
+//
+// Results are written one JSON object per line, so that runs from different
+// releases can be compared by script. The topologies and rules are generated
+// from a fixed seed, so the same arguments always measure the same thing.
+
+
+
+namespace {
+
+  const char* hardwareNames[] = {
+    "Launchpad X", "Launchpad Mini MK3", "MicroMonsta 2", "Digitone",
+    "Digitakt", "OP-1", "Circuit Tracks", "Arturia KeyStep",
+    "Arturia BeatStep Pro", "nanoKONTROL2", "MPK mini 3", "Scarlett 2i4 USB",
+    "UM-ONE", "Prophet Rev2", "Minilogue xd", "TR-8S", "MIDI Mate eX",
+  };
+  const char* applicationNames[] = {
+    "Pure Data", "VCV Rack", "Bitwig Studio", "Ardour", "SuperCollider",
+    "FLUID Synth", "Yoshimi", "a2jmidid", "Carla", "Surge XT",
+  };
+
+  template <typename T, std::size_t N>
+  std::size_t countOf(T (&)[N]) { return N; }
+
+  const unsigned int hwCaps =
+    SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_WRITE
+    | SND_SEQ_PORT_CAP_SUBS_READ | SND_SEQ_PORT_CAP_SUBS_WRITE
+    | SND_SEQ_PORT_CAP_DUPLEX;
+  const unsigned int inCaps =
+    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+  const unsigned int outCaps =
+    SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+
+
+  struct Topology {
+    std::vector<Address> ports;
+    std::vector<std::string> clientNames;
+    std::vector<std::string> portNames;
+  };
+
+  // Hardware clients get ids from 20, each port is duplex and named after
+  // the device, as USB MIDI devices are. Application clients get ids from
+  // 128, and alternate input and output ports.
+  Topology makeTopology(int clients, int portsPerClient) {
+    Topology t;
+    int hwClients = (clients + 1) / 2;
+
+    for (int c = 0; c < clients; ++c) {
+      bool hw = c < hwClients;
+      int k = hw ? c : c - hwClients;
+      std::string name = hw
+        ? hardwareNames[k % countOf(hardwareNames)]
+        : applicationNames[k % countOf(applicationNames)];
+      std::size_t copy = k / (hw ? countOf(hardwareNames) : countOf(applicationNames));
+      if (copy > 0)
+        name += " " + std::to_string(copy + 1);
+      t.clientNames.push_back(name);
+
+      client_id_t id = hw ? 20 + k : 128 + k;
+      for (int p = 0; p < portsPerClient; ++p) {
+        std::string portName;
+        unsigned int caps;
+        if (hw) {
+          portName = name + " MIDI " + std::to_string(p + 1);
+          caps = hwCaps;
+        }
+        else {
+          portName = (p % 2 ? "Midi-Out " : "Midi-In ") + std::to_string(p / 2 + 1);
+          caps = p % 2 ? outCaps : inCaps;
+        }
+
+        snd_seq_addr_t addr = { id, static_cast<unsigned char>(p) };
+        Address a(addr, true, caps,
+          SND_SEQ_PORT_TYPE_MIDI_GENERIC
+            | (hw ? SND_SEQ_PORT_TYPE_HARDWARE : SND_SEQ_PORT_TYPE_APPLICATION),
+          name, portName);
+        t.ports.push_back(a);
+        t.portNames.push_back(a.port);
+      }
+    }
+    return t;
+  }
+
+  // Rules are a mix, roughly as found in real profiles: mostly partial
+  // client names, then exact client and port names, with some wildcards,
+  // port types, numeric ports, and blocking rules. About half name clients
+  // that aren't in the topology at all.
+  std::string makeSpec(std::mt19937& rng, const Topology& t) {
+    auto pick = [&](const std::vector<std::string>& v) -> const std::string&
+      { return v[rng() % v.size()]; };
+
+    std::string client = pick(t.clientNames);
+    if (rng() % 2)
+      client = "Absent Device " + std::to_string(rng() % 1000);
+    std::string port = pick(t.portNames);
+
+    switch (rng() % 12) {
+      case 0:   return "*";
+      case 1:   return rng() % 2 ? ".hw" : ".app";
+      case 2:
+      case 3:   return "\"" + client + "\":\"" + port + "\"";
+      case 4:   return "\"" + client + "\"";
+      case 5:   return client + ":=" + std::to_string(rng() % 4);
+      case 6:   return client + ":" + port.substr(0, 6);
+      default:  return client.substr(0, 4 + rng() % 6);
+    }
+  }
+
+  ConnectionRules makeRules(int count, const Topology& t) {
+    std::mt19937 rng(count);
+    std::string text;
+    for (int i = 0; i < count; ++i) {
+      const char* arrow = rng() % 8 ? " --> " : " -x-> ";
+      text += makeSpec(rng, t) + arrow + makeSpec(rng, t) + "\n";
+    }
+
+    ConnectionRules rules;
+    if (!parseRules(text, rules))
+      throw Msg::runtime_error("generated rules didn't parse");
+    return rules;
+  }
+
+
+  class SyntheticSystem : public ConnectionLogic {
+    public:
+      SyntheticSystem(const Topology& t, const ConnectionRules& rules) {
+        for (auto& a : t.ports)
+          system[a.addr] = a;
+        profileRules = rules;
+        rulesChanged();
+      }
+
+      // Ports are added as they would be announced: client by client.
+      void addPort(const snd_seq_addr_t& addr) {
+        ConnectionLogic::addPort(addr);
+        settle();
+      }
+
+      // As when a device with several ports is plugged in: all the ports
+      // are announced, then connected together.
+      void addBurst(const Address* begin, const Address* end) {
+        for (auto a = begin; a != end; ++a)
+          addPortToBatch(a->addr);
+        connectNewPorts();
+        settle();
+      }
+
+      void resetConnectionsSoft() {
+        ConnectionLogic::resetConnectionsSoft();
+        settle();
+      }
+
+      void removeAllPorts() {
+        clearPorts();
+        activeConnections.clear();
+        subscriptions.clear();
+      }
+
+      std::size_t connectionCount() const { return subscriptions.size(); }
+      const std::set<snd_seq_connect_t>& connections() const
+        { return subscriptions; }
+
+      const ConnectionRules& rules() const { return profileRules; }
+      const RuleIndex& index() const { return profileIndex; }
+
+    protected:
+      Address portAddress(const snd_seq_addr_t& addr) override {
+        auto i = system.find(addr);
+        return i == system.end() ? Address() : i->second;
+      }
+      void connectPorts(const snd_seq_connect_t& c) override
+        { subscriptions.insert(c); }
+      void disconnectPorts(const snd_seq_connect_t& c) override
+        { subscriptions.erase(c); }
+      void observedRuleRemoved(std::size_t, const ConnectionRule&) override
+        { }
+      void observedRuleAdded(const ConnectionRule&) override
+        { }
+
+    private:
+      std::map<snd_seq_addr_t, Address> system;
+      std::set<snd_seq_connect_t> subscriptions;
+
+      void settle() {
+        // The SUBSCRIBED and UNSUBSCRIBED events the kernel would send
+        // back have arrived.
+        expectedConnects.clear();
+        expectedDisconnects.clear();
+        scratchArena().reset();   // as the daemon does after each event
+      }
+  };
+
+
+  using Clock = std::chrono::steady_clock;
+  const auto minimumTime = std::chrono::milliseconds(200);
+
+  double micros(Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  // Runs f repeatedly, for at least minimumTime, and returns the mean
+  // microseconds per run. Each run is a pass of the daemon's event loop,
+  // so the scratch arena is reset after it.
+  template <typename F>
+  double timePerRun(F f) {
+    int runs = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (elapsed < minimumTime) {
+      f();
+      scratchArena().reset();
+      runs += 1;
+      elapsed = Clock::now() - start;
+    }
+    return micros(elapsed) / runs;
+  }
+
+  double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    std::size_t i = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+  }
+
+
+  struct Config {
+    int clients;
+    int portsPerClient;
+    int rules;
+  };
+
+  // Starts a JSON result line, with the configuration it was run under.
+  std::string result(const char* bench, const Config& c, const Topology& t) {
+    return fmt::format(
+      "{{\"bench\":\"{}\",\"clients\":{},\"portsPerClient\":{},"
+      "\"ports\":{},\"rules\":{}",
+      bench, c.clients, c.portsPerClient, t.ports.size(), c.rules);
+  }
+
+
+  void benchAddPort(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    std::vector<double> samples;
+    samples.reserve(1 << 20);
+    unsigned long allocs = 0;
+    auto start = Clock::now();
+    while (Clock::now() - start < minimumTime) {
+      sys.removeAllPorts();
+      auto before = Allocations::count();
+      for (auto& a : t.ports) {
+        auto t0 = Clock::now();
+        sys.addPort(a.addr);
+        samples.push_back(micros(Clock::now() - t0));
+      }
+      allocs += Allocations::count() - before;
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (auto s : samples) total += s;
+
+    fmt::print("{},\"samples\":{},\"connections\":{},"
+      "\"meanUs\":{:.3f},\"p50Us\":{:.3f},\"p90Us\":{:.3f},\"p99Us\":{:.3f},"
+      "\"maxUs\":{:.3f},\"allocsPerPort\":{:.1f}}}\n",
+      result("addPort", c, t), samples.size(), sys.connectionCount(),
+      total / samples.size(), percentile(samples, 0.5),
+      percentile(samples, 0.9), percentile(samples, 0.99), samples.back(),
+      double(allocs) / samples.size());
+  }
+
+  void benchAddBurst(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    std::vector<double> samples;
+    auto start = Clock::now();
+    while (Clock::now() - start < minimumTime) {
+      sys.removeAllPorts();
+      for (std::size_t i = 0; i < t.ports.size(); i += c.portsPerClient) {
+        auto t0 = Clock::now();
+        sys.addBurst(&t.ports[i], &t.ports[i] + c.portsPerClient);
+        samples.push_back(micros(Clock::now() - t0));
+      }
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (auto s : samples) total += s;
+
+    fmt::print("{},\"samples\":{},\"connections\":{},"
+      "\"meanUs\":{:.3f},\"p50Us\":{:.3f},\"p99Us\":{:.3f},"
+      "\"meanUsPerPort\":{:.3f}}}\n",
+      result("addBurst", c, t), samples.size(), sys.connectionCount(),
+      total / samples.size(), percentile(samples, 0.5),
+      percentile(samples, 0.99), total / samples.size() / c.portsPerClient);
+  }
+
+  void benchResetSoft(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    sys.removeAllPorts();
+    for (auto& a : t.ports)
+      sys.addPort(a.addr);
+
+    double us = timePerRun([&](){ sys.resetConnectionsSoft(); });
+
+    fmt::print("{},\"connections\":{},\"meanUs\":{:.3f}}}\n",
+      result("resetConnectionsSoft", c, t), sys.connectionCount(), us);
+  }
+
+  void benchFindRule(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    std::vector<std::pair<const Address*, const Address*>> pairs;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 4096; ++i)
+      pairs.push_back({ &t.ports[rng() % t.ports.size()],
+                        &t.ports[rng() % t.ports.size()] });
+
+    std::size_t lookups = 0;
+    std::size_t found = 0;
+    double us = timePerRun([&](){
+      for (auto& p : pairs)
+        if (findRule(sys.rules(), sys.index(), *p.first, *p.second).found
+            != Found::NoRule)
+          found += 1;
+      lookups += pairs.size();
+    });
+
+    fmt::print("{},\"lookupsPerSec\":{:.0f},\"foundFraction\":{:.3f}}}\n",
+      result("findRule", c, t), pairs.size() / us * 1e6,
+      double(found) / lookups);
+  }
+
+  void benchRuleMatches(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    auto& rules = sys.rules();
+    auto& index = sys.index();
+    auto ports = t.ports;
+    for (auto& a : ports)
+      a.primarySender = a.primaryDest = a.addr.port == 0;
+
+    double linear = timePerRun([&](){
+      for (auto& a : ports)
+        for (auto& r : rules) {
+          r.senderMatch(a);
+          r.destMatch(a);
+        }
+    }) / ports.size();
+
+    double indexed = timePerRun([&](){
+      for (auto& a : ports)
+        RuleMatches(rules, index, a);
+    }) / ports.size();
+
+    bool same = true;
+    for (auto& a : ports) {
+      RuleMatches m(rules, index, a);
+      for (std::size_t i = 0; i < rules.size(); ++i)
+        same = same
+          && m.asSender.test(i) == rules[i].senderMatch(a)
+          && m.asDest.test(i) == rules[i].destMatch(a);
+    }
+
+    fmt::print("{},\"linearUsPerPort\":{:.3f},\"indexedUsPerPort\":{:.3f},"
+      "\"agree\":{}}}\n",
+      result("ruleMatches", c, t), linear, indexed, same ? "true" : "false");
+  }
+
+  void benchTables(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    // The tables the logic keeps, filled as addPort leaves them, against
+    // the std::map and std::set they replaced. Lookups are a mix of
+    // present and absent entries, in a fixed random order.
+    sys.removeAllPorts();
+    for (auto& a : t.ports)
+      sys.addPort(a.addr);
+
+    std::map<snd_seq_addr_t, Address> portMap;
+    PortTable<Address> portTable;
+    for (auto& a : t.ports) {
+      portMap[a.addr] = a;
+      portTable[a.addr] = a;
+    }
+
+    std::set<snd_seq_connect_t> connSet;
+    ConnectionSet connTable;
+    for (auto& conn : sys.connections()) {
+      connSet.insert(conn);
+      connTable.insert(conn);
+    }
+
+    std::mt19937 rng(2);
+    std::vector<snd_seq_addr_t> addrs;
+    std::vector<snd_seq_connect_t> conns;
+    for (int i = 0; i < 4096; ++i) {
+      auto& s = t.ports[rng() % t.ports.size()].addr;
+      auto& d = t.ports[rng() % t.ports.size()].addr;
+      addrs.push_back(i % 2 ? s : snd_seq_addr_t{ s.client, 200 });
+      conns.push_back({ s, d });
+    }
+
+    std::size_t found = 0;
+    auto perSec = [&](double us) { return addrs.size() / us * 1e6; };
+    double mapUs = timePerRun([&](){
+      for (auto& a : addrs) found += portMap.find(a) != portMap.end();
+    });
+    double tableUs = timePerRun([&](){
+      for (auto& a : addrs) found += portTable.find(a) != portTable.end();
+    });
+    double setUs = timePerRun([&](){
+      for (auto& conn : conns) found += connSet.find(conn) != connSet.end();
+    });
+    double hashUs = timePerRun([&](){
+      for (auto& conn : conns) found += connTable.has(conn);
+    });
+
+    // As resets do: empty and refill the connections.
+    double setFillUs = timePerRun([&](){
+      std::set<snd_seq_connect_t> s;
+      for (auto& conn : sys.connections()) s.insert(conn);
+      found += s.size();
+    });
+    double hashFillUs = timePerRun([&](){
+      ConnectionSet s;
+      for (auto& conn : sys.connections()) s.insert(conn);
+      found += s.size();
+    });
+
+    bool same = connSet.size() == connTable.size();
+    for (auto& conn : conns)
+      same = same && (connSet.count(conn) > 0) == connTable.has(conn);
+    for (auto& a : addrs)
+      same = same
+        && (portMap.find(a) == portMap.end()) == (portTable.find(a) == portTable.end());
+
+    fmt::print("{},\"connections\":{},"
+      "\"mapLookupsPerSec\":{:.0f},\"tableLookupsPerSec\":{:.0f},"
+      "\"setLookupsPerSec\":{:.0f},\"hashLookupsPerSec\":{:.0f},"
+      "\"setFillUs\":{:.3f},\"hashFillUs\":{:.3f},\"agree\":{}}}\n",
+      result("tables", c, t), connTable.size(),
+      perSec(mapUs), perSec(tableUs), perSec(setUs), perSec(hashUs),
+      setFillUs, hashFillUs, same && found ? "true" : "false");
+  }
+
+  void benchSnapshot(const Config& c, const Topology& t, SyntheticSystem& sys) {
+    // What SeqSnapshot::refresh() does with the Addresses it gets: make
+    // each from the names the kernel returns, keep it in addrMap and in
+    // ports, and copy two into each Connection. (Everything else it does
+    // needs ALSA.)
+    sys.removeAllPorts();
+    for (auto& a : t.ports)
+      sys.addPort(a.addr);
+
+    std::vector<std::pair<std::string, std::string>> names;
+    for (auto& a : t.ports)
+      names.push_back({ a.client, a.portLong });
+
+    std::map<snd_seq_addr_t, Address> addrMap;
+    std::vector<Address> ports;
+    std::vector<SeqSnapshot::Connection> connections;
+
+    auto refresh = [&](){
+      addrMap.clear();
+      ports.clear();
+      connections.clear();
+      for (std::size_t i = 0; i < t.ports.size(); ++i) {
+        auto& a = t.ports[i];
+        Address address(a.addr, a.mindable, a.caps, a.types,
+          names[i].first.c_str(), names[i].second.c_str());
+        addrMap[a.addr] = address;
+        ports.push_back(address);
+      }
+      for (auto& conn : sys.connections())
+        connections.push_back({ addrMap[conn.sender], addrMap[conn.dest] });
+    };
+
+    refresh();    // so that the vectors have their capacity
+    auto before = Allocations::count();
+    const int runs = 20;
+    for (int i = 0; i < runs; ++i)
+      refresh();
+    double perRefresh = double(Allocations::count() - before) / runs;
+
+    double us = timePerRun(refresh);
+
+    fmt::print("{},\"connections\":{},\"allocsPerRefresh\":{:.0f},"
+      "\"meanUs\":{:.3f}}}\n",
+      result("snapshot", c, t), connections.size(), perRefresh, us);
+  }
+
+
+  void run(const Config& c) {
+    Topology t = makeTopology(c.clients, c.portsPerClient);
+    SyntheticSystem sys(t, makeRules(c.rules, t));
+
+    benchAddPort(c, t, sys);
+    benchAddBurst(c, t, sys);
+    benchResetSoft(c, t, sys);
+    benchFindRule(c, t, sys);
+    benchRuleMatches(c, t, sys);
+    benchTables(c, t, sys);
+    benchSnapshot(c, t, sys);
+    std::fflush(stdout);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<int> clients = { 8, 32, 96 };
+  std::vector<int> ports = { 4 };
+  std::vector<int> rules = { 10, 100, 1000 };
+
+  CLI::App app{"Benchmark the midiminder connection logic"};
+  app.add_option("-c,--clients", clients, "Numbers of clients to run with")
+    ->check(CLI::Range(1, 100));
+  app.add_option("-p,--ports", ports, "Numbers of ports per client to run with")
+    ->check(CLI::Range(1, 64));
+  app.add_option("-r,--rules", rules, "Numbers of profile rules to run with")
+    ->check(CLI::Range(0, 100000));
+  CLI11_PARSE(app, argc, argv);
+
+  Msg::verbosity = 0;   // the logic is chatty about every connection
+
+  try {
+    for (int c : clients)
+      for (int p : ports)
+        for (int r : rules)
+          run({c, p, r});
+  }
+  catch (const std::exception& e) {
+    Msg::error("{}", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,552 @@
+#include "connection-logic.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "arena.h"
+#include "msg.h"
+
+
+namespace {
+
+  enum class RuleSource {
+    profile,
+    observed,
+  };
+
+  const char* ruleSourceName(RuleSource r) {
+    switch (r) {
+      case RuleSource::profile:    return "profile";
+      case RuleSource::observed:   return "observed";
+      default:                     return "???";
+    }
+  }
+
+
+  using ActivePorts = PortTable<ActivePort>;
+
+  struct Resolution {
+    const ConnectionRule* rule;   // nullptr if no rule matches
+    RuleSource source;
+  };
+
+  // Decides a single (sender, dest) pair: The last rule that matches both
+  // is the one that applies, and observed rules take precedence over
+  // profile rules. Which rules match which ports has already been
+  // computed, so this is just a matter of finding the last bit the ports
+  // have in common.
+
+  Resolution resolveConnection(const ActivePort& sender, const ActivePort& dest,
+    const ConnectionRules& profileRules, const ConnectionRules& observedRules)
+  {
+    std::size_t i;
+    if (RuleBits::lastInBoth(
+          sender.observedMatches.asSender, dest.observedMatches.asDest, i))
+      return {&observedRules[i], RuleSource::observed};
+    if (RuleBits::lastInBoth(
+          sender.profileMatches.asSender, dest.profileMatches.asDest, i))
+      return {&profileRules[i], RuleSource::profile};
+    return {nullptr, RuleSource::profile};
+  }
+
+  bool hasAnyMatches(const ActivePort& p) {
+    return p.profileMatches.asSender.any() || p.profileMatches.asDest.any()
+      || p.observedMatches.asSender.any() || p.observedMatches.asDest.any();
+  }
+}
+
+
+int PortSet::next(int p) const {
+  for (int w = (p + 1) / 64; w < 4; ++w) {
+    uint64_t rest = words[w];
+    if (w == (p + 1) / 64)
+      rest &= ~uint64_t(0) << ((p + 1) % 64);
+    if (rest)
+      return w * 64 + __builtin_ctzll(rest);
+  }
+  return -1;
+}
+
+
+void ConnectionLogic::rulesChanged() {
+// reindex the rules, and recompute which rules each active port matches
+  rulesGeneration += 1;
+  profileIndex = RuleIndex(profileRules);
+  observedIndex = RuleIndex(observedRules);
+
+  for (auto& p : activePorts) {
+    auto& ap = p.second;
+    ap.profileMatches.update(profileRules, profileIndex, ap.address);
+    ap.observedMatches.update(observedRules, observedIndex, ap.address);
+  }
+}
+
+void ConnectionLogic::observedRulesChanged() {
+// as rulesChanged(), but the profile index and matches are still good
+  rulesGeneration += 1;
+  observedIndex = RuleIndex(observedRules);
+
+  for (auto& p : activePorts) {
+    auto& ap = p.second;
+    ap.observedMatches.update(observedRules, observedIndex, ap.address);
+  }
+}
+
+void ConnectionLogic::resetConnectionsSoft() {
+// reset ports & connections without rescanning the system
+  ConnectionGraph doomed;
+  doomed.swap(activeConnections);
+  for (auto& c : doomed) {
+    disconnectPorts(c);  // will generate UNSUB events that should be ignored
+    expectedDisconnects.insert(c);
+  }
+
+  ActivePorts ports;
+  ports.swap(activePorts);
+  activeClients.fill({});
+  for (auto& p: ports)
+    addPort(p.first, true); // does regenreate the Address from portAddress()
+}
+
+
+Reconciliation ConnectionLogic::reconcileConnections() {
+// bring the connections in line with the rules, for the current ports,
+// touching only those connections that need to change
+
+  ActivePorts ports;
+  ports.swap(activePorts);
+  activeClients.fill({});
+  for (auto& p: ports)
+    notePort(p.first, true); // refreshes the Address and primary status
+
+  return updateConnections();
+}
+
+Reconciliation ConnectionLogic::updateConnections() {
+// make activeConnections be what the rules want for activePorts
+
+  struct Wanted {
+    snd_seq_connect_t conn;
+    const ActivePort& sender;
+    const ActivePort& dest;
+    Resolution resolution;
+  };
+  ScratchVector<Wanted> wanted;
+
+  // activePorts is in address order, so wanted comes out sorted
+  for (auto& s : activePorts) {
+    if (!s.second.address.canBeSender()) continue;
+    for (auto& d : activePorts) {
+      if (!d.second.address.canBeDest()) continue;
+      auto r = resolveConnection(s.second, d.second, profileRules, observedRules);
+      if (r.rule && !r.rule->isBlockingRule())
+        wanted.push_back({{s.first, d.first}, s.second, d.second, r});
+    }
+  }
+
+  auto isWanted = [&](const snd_seq_connect_t& c) {
+    auto i = std::lower_bound(wanted.begin(), wanted.end(), c,
+      [](const Wanted& w, const snd_seq_connect_t& c) { return w.conn < c; });
+    return i != wanted.end() && !(c < i->conn);
+  };
+
+  Reconciliation result;
+  ScratchVector<snd_seq_connect_t> doomed;
+  for (auto& c : activeConnections) {
+    if (isWanted(c)) {
+      result.disconnectsSkipped += 1;
+      continue;
+    }
+    doomed.push_back(c);
+  }
+  std::sort(doomed.begin(), doomed.end());
+  for (auto& c : doomed) {
+    disconnectPorts(c);  // will generate UNSUB events that should be ignored
+    expectedDisconnects.insert(c);
+    activeConnections.erase(c);
+    result.disconnected += 1;
+    Msg::output("Disconnecting {} --> {}", knownPort(c.sender), knownPort(c.dest));
+  }
+
+  for (auto& w : wanted) {
+    auto& c = w.conn;
+    if (activeConnections.has(c)) {
+      result.connectsSkipped += 1;
+      continue;
+    }
+    connectPorts(c);
+    expectedConnects.insert(c);
+    activeConnections.insert(c);
+    result.connected += 1;
+    Msg::output("Connecting {} --> {}\n    by {} rule: {}",
+      w.sender.address, w.dest.address,
+      ruleSourceName(w.resolution.source), *w.resolution.rule);
+  }
+
+  Msg::output("Connections: {} kept, {} disconnected, {} connected.",
+    result.disconnectsSkipped, result.disconnected, result.connected);
+  return result;
+}
+
+
+const Address& ConnectionLogic::knownPort(snd_seq_addr_t addr) {
+  const auto i = activePorts.find(addr);
+  if (i == activePorts.end()) return Address::null;
+  return i->second.address;
+}
+
+
+// Note: A client's primary sender is its lowest numbered port that can be
+// a sender, and likewise for its primary dest. This is what a scan of the
+// system finds, as it visits ports in order. Applications almost always
+// create their ports from zero, in order, and delete them all together,
+// but should one create them out of order, or delete its low numbered
+// ports and carry on, the primary status moves: The new primary is noted
+// again, and connected as a new port would be. The old one keeps the
+// connections it has, as with a rename, until the next reset.
+
+void ConnectionLogic::addPort(const snd_seq_addr_t& addr, bool fromReset ) {
+  if (auto ap = notePort(addr, fromReset))
+    connectPort(*ap);
+}
+
+ActivePort* ConnectionLogic::notePort(const snd_seq_addr_t& addr, bool fromReset) {
+// adds the port to activePorts, returns nullptr if known or not mindable
+  if (knownPort(addr)) return nullptr;
+
+  decisionCache.forgetPort(addr);
+
+  Address a = portAddress(addr);
+  if (!a.mindable) return nullptr;
+
+  auto& ac = activeClients[addr.client];
+  ac.ports.insert(addr.port);
+  if (a.canBeSender()) {
+    ac.senders.insert(addr.port);
+    a.primarySender = ac.senders.next() == addr.port;
+  }
+  if (a.canBeDest()) {
+    ac.dests.insert(addr.port);
+    a.primaryDest = ac.dests.next() == addr.port;
+  }
+
+  auto& ap = activePorts[addr];
+  ap.address = a;
+  ap.profileMatches.update(profileRules, profileIndex, a);
+  ap.observedMatches.update(observedRules, observedIndex, a);
+  Msg::output("{} port: {}", fromReset ? "Reviewing" : "System added", a);
+
+  // created below the client's primary port, so it takes over from it
+  int nextSender = a.primarySender ? ac.senders.next(addr.port) : -1;
+  if (nextSender >= 0)
+    changePrimary({addr.client, (unsigned char)nextSender}, true, false);
+  int nextDest = a.primaryDest ? ac.dests.next(addr.port) : -1;
+  if (nextDest >= 0)
+    changePrimary({addr.client, (unsigned char)nextDest}, false, false);
+
+  return &ap;
+}
+
+void ConnectionLogic::changePrimary(
+  const snd_seq_addr_t& addr, bool asSender, bool primary)
+{
+  auto i = activePorts.find(addr);
+  if (i == activePorts.end())
+    return;
+
+  auto& ap = i->second;
+  Address& a = ap.address;
+  (asSender ? a.primarySender : a.primaryDest) = primary;
+
+  decisionCache.forgetPort(addr);
+  ap.profileMatches.update(profileRules, profileIndex, a);
+  ap.observedMatches.update(observedRules, observedIndex, a);
+  Msg::output("{} primary {}: {}",
+    primary ? "Now" : "No longer", asSender ? "sender" : "dest", a);
+
+  if (primary)
+    newPorts.push_back(addr);   // connect it as if it had just arrived
+}
+
+void ConnectionLogic::connectPort(const ActivePort& ap) {
+  if (!hasAnyMatches(ap))
+    return;
+
+  auto connectByRule = [&](const ActivePort& sender, const ActivePort& dest) {
+    auto r = resolveConnection(sender, dest, profileRules, observedRules);
+    if (!r.rule || r.rule->isBlockingRule())
+      return;
+
+    snd_seq_connect_t conn = {sender.address.addr, dest.address.addr};
+    if (!activeConnections.has(conn)) {
+      connectPorts(conn);
+      expectedConnects.insert(conn);
+      activeConnections.insert(conn);
+      Msg::output("Connecting {} --> {}\n    by {} rule: {}",
+        sender.address, dest.address, ruleSourceName(r.source), *r.rule);
+    }
+  };
+
+  const Address& a = ap.address;
+  for (auto& p : activePorts) {
+    auto& b = p.second;
+    if (a.canBeSender() && b.address.canBeDest())
+      connectByRule(ap, b);
+    if (a.canBeDest() && b.address.canBeSender() && &b != &ap)
+      connectByRule(b, ap);
+  }
+}
+
+void ConnectionLogic::addPortToBatch(const snd_seq_addr_t& addr) {
+  if (notePort(addr, false))
+    newPorts.push_back(addr);
+}
+
+void ConnectionLogic::connectNewPorts() {
+  // connecting doesn't add to newPorts, so it can be walked in place, and
+  // its space kept for the next burst
+  for (auto& addr : newPorts) {
+    auto i = activePorts.find(addr);
+    if (i != activePorts.end())   // it may have gone again in the same burst
+      connectPort(i->second);
+  }
+  newPorts.clear();
+}
+
+void ConnectionLogic::reviewClient(
+  client_id_t c, const std::vector<snd_seq_addr_t>& ports)
+{
+  ScratchVector<snd_seq_connect_t> kept;
+  auto& ac = activeClients[c];
+  for (int p = ac.ports.next(); p >= 0; p = ac.ports.next(p)) {
+    auto conns = activeConnections.connectionsOf({c, (unsigned char)p});
+    kept.insert(kept.end(), conns.begin(), conns.end());
+  }
+
+  delClient(c);
+
+  for (auto& p : ports)
+    if (notePort(p, true))
+      newPorts.push_back(p);
+
+  // Renaming doesn't break connections in the kernel, so these still
+  // exist, as long as both ends are still mindable.
+  for (auto& conn : kept)
+    if (knownPort(conn.sender) && knownPort(conn.dest))
+      activeConnections.insert(conn);
+}
+
+void ConnectionLogic::delPort(const snd_seq_addr_t& addr) {
+  const Address& port = knownPort(addr);
+  if (!port)
+    return;
+
+  Msg::output("System removed port: {}", port);
+
+  for (auto& c : activeConnections.connectionsOf(addr)) {
+    const Address& sender = knownPort(c.sender);
+    const Address& dest = knownPort(c.dest);
+    if (sender && dest)
+      Msg::detail("    disconnected {} --> {}", sender, dest);
+  }
+
+  bool wasPrimarySender = port.primarySender;
+  bool wasPrimaryDest = port.primaryDest;
+  activePorts.erase(addr);
+  activeConnections.eraseAllOf(addr);
+
+  auto& ac = activeClients[addr.client];
+  ac.ports.erase(addr.port);
+  ac.senders.erase(addr.port);
+  ac.dests.erase(addr.port);
+
+  // the client's next port, if it has one, becomes primary
+  if (wasPrimarySender && !ac.senders.empty())
+    changePrimary({addr.client, (unsigned char)ac.senders.next()}, true, true);
+  if (wasPrimaryDest && !ac.dests.empty())
+    changePrimary({addr.client, (unsigned char)ac.dests.next()}, false, true);
+}
+
+void ConnectionLogic::delClient(client_id_t c) {
+  auto& ac = activeClients[c];
+  for (int p = ac.ports.next(); p >= 0; p = ac.ports.next(p)) {
+    activePorts.erase({c, (unsigned char)p});
+    activeConnections.eraseAllOf({c, (unsigned char)p});
+  }
+  ac = {};
+}
+
+void ConnectionLogic::clearPorts() {
+  activePorts.clear();
+  activeClients.fill({});
+}
+
+void ConnectionLogic::eventsLost() {
+  expectedConnects.clear();
+  expectedDisconnects.clear();
+  newPorts.clear();
+}
+
+
+DecisionCache::Decision
+ConnectionLogic::findRules(const Address& sender, const Address& dest) {
+  snd_seq_connect_t conn = {sender.addr, dest.addr};
+  if (auto d = decisionCache.find(conn, rulesGeneration))
+    return *d;
+
+  DecisionCache::Decision d = {
+    findRule(observedRules, observedIndex, sender, dest),
+    findRule(profileRules, profileIndex, sender, dest)
+  };
+  decisionCache.insert(conn, rulesGeneration, d);
+  return d;
+}
+
+
+void ConnectionLogic::addConnection(const snd_seq_connect_t& conn) {
+  if (activeConnections.has(conn))
+    // already know about this connection
+    return;
+
+  const Address& sender = knownPort(conn.sender);
+  const Address& dest = knownPort(conn.dest);
+  if (!sender || !dest)
+    return;
+
+  Msg::output("Observed connection: {} --> {}", sender, dest);
+
+  activeConnections.insert(conn);
+
+  auto found = findRules(sender, dest);
+  auto oFind = found.observed.found;
+  auto oRule = observedRules.begin() + found.observed.position;
+  auto pFind = found.profile.found;
+  auto pRule = profileRules.begin() + found.profile.position;
+
+  bool removeObsRule = false;
+  bool addNewObsRule = false;
+
+  switch (oFind) {
+    case Found::NoRule:
+      if (pFind == Found::ConnectRule)
+        Msg::output("    already have a profile rule {}", *pRule);
+      else
+        addNewObsRule = true;
+      break;
+
+    case Found::ConnectRule:
+      Msg::output("    already have an observed rule {}", *oRule);
+      if (pFind == Found::ConnectRule) {
+        Msg::output("    removing, as also have a profile rule {}", *pRule);
+        removeObsRule = true;
+      }
+      break;
+
+    case Found::DisallowRule:
+      Msg::output("    removing observed disallow rule {}", *oRule);
+      removeObsRule = true;
+      switch (pFind) {
+        case Found::NoRule:
+          Msg::output("    no expected profile rule found");
+          addNewObsRule = true;
+          break;
+        case Found::ConnectRule:
+          break;
+        case Found::DisallowRule:
+          Msg::output("    also have a profile disallow rule {}", *pRule);
+          addNewObsRule = true;
+      }
+  }
+
+  if (removeObsRule) {
+    observedRuleRemoved(oRule - observedRules.begin(), *oRule);
+    observedRules.erase(oRule);
+  }
+
+  if (addNewObsRule) {
+    ConnectionRule c = ConnectionRule::exact(sender, dest);
+    observedRules.push_back(c);
+    observedRuleAdded(c);
+    Msg::output("    adding observed rule {}", c);
+  }
+
+  if (removeObsRule || addNewObsRule)
+    observedRulesChanged();
+}
+
+void ConnectionLogic::delConnection(const snd_seq_connect_t& conn) {
+  if (!activeConnections.erase(conn))
+    // don't know anything about this connection
+    return;
+
+  const Address& sender = knownPort(conn.sender);
+  const Address& dest = knownPort(conn.dest);
+  if (!sender || !dest)
+    return;
+
+  Msg::output("Observed disconnection: {} --> {}", sender, dest);
+
+  auto found = findRules(sender, dest);
+  auto oFind = found.observed.found;
+  auto oRule = observedRules.begin() + found.observed.position;
+  auto pFind = found.profile.found;
+  auto pRule = profileRules.begin() + found.profile.position;
+
+  bool removeObsRule = false;
+  bool addNewObsRule = false;
+
+  switch (oFind) {
+    case Found::NoRule:
+      switch (pFind) {
+        case Found::NoRule:
+          Msg::output("    no rules found, doing nothing");
+          break;
+        case Found::ConnectRule:
+          addNewObsRule = true;
+          break;
+        case Found::DisallowRule:
+          Msg::output("    already have a profile rule {}", *pRule);
+          break;
+      }
+      break;
+
+    case Found::ConnectRule:
+      Msg::output("    removing observed rule {}", *oRule);
+      removeObsRule = true;
+      if (pFind == Found::ConnectRule) {
+        Msg::output("    also have a profile rule {}", *pRule);
+        addNewObsRule = true;
+      }
+      break;
+
+    case Found::DisallowRule:
+      Msg::output("    already have an observed rule {}", *oRule);
+      switch (pFind) {
+        case Found::NoRule:
+          Msg::output("    but no profile rule, so removing");
+          removeObsRule = true;
+          break;
+        case Found::ConnectRule:
+          break;
+        case Found::DisallowRule:
+          Msg::output("    removing, as also have a profile rule {}", *pRule);
+          removeObsRule = true;
+      }
+      break;
+  }
+
+  if (removeObsRule) {
+    observedRuleRemoved(oRule - observedRules.begin(), *oRule);
+    observedRules.erase(oRule);
+  }
+
+  if (addNewObsRule) {
+    ConnectionRule c = ConnectionRule::exactBlock(sender, dest);
+    observedRules.push_back(c);
+    observedRuleAdded(c);
+    Msg::output("    adding observed rule {}", c);
+  }
+
+  if (removeObsRule || addNewObsRule)
+    observedRulesChanged();
+}
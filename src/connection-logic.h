@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "addrtables.h"
+#include "rule.h"
+#include "rulematch.h"
+#include "seq.h"
+
+struct ActivePort {
+  Address address;
+  RuleMatches profileMatches;
+  RuleMatches observedMatches;
+};
+
+// A set of port numbers, as one bit per port, so it never allocates.
+class PortSet {
+  public:
+    void insert(unsigned char p)  { words[p / 64] |= bit(p); }
+    void erase(unsigned char p)   { words[p / 64] &= ~bit(p); }
+    bool empty() const
+      { return !(words[0] | words[1] | words[2] | words[3]); }
+
+    // The lowest port in the set above p, or -1 if there is none. Walk the
+    // set with: for (int p = s.next(); p >= 0; p = s.next(p))
+    int next(int p = -1) const;
+
+  private:
+    static uint64_t bit(unsigned char p) { return uint64_t(1) << (p % 64); }
+
+    std::array<uint64_t, 4> words = {};
+};
+
+// The active ports of one client, by port number. The lowest numbered port
+// that can be a sender is the client's primary sender, and likewise for
+// dests.
+struct ActiveClient {
+  PortSet ports;
+  PortSet senders;
+  PortSet dests;
+};
+
+// What bringing the connections in line with the rules did, and what it
+// left alone that a full reset would have disconnected and connected again.
+struct Reconciliation {
+  std::size_t disconnected = 0;
+  std::size_t connected = 0;
+  std::size_t disconnectsSkipped = 0;   // existing connections that were kept
+  std::size_t connectsSkipped = 0;      // wanted connections already there
+
+  std::size_t skipped() const { return disconnectsSkipped + connectsSkipped; }
+};
+
+
+// The model the daemon keeps of ports, connections, and the rules between
+// them: It decides which connections to make as ports come and go, and how
+// the observed rules change as the user connects and disconnects things.
+//
+// The system of ports it is minding is supplied by a subclass. For the
+// daemon, that is the ALSA Sequencer. The benchmark supplies a synthetic
+// one.
+
+class ConnectionLogic {
+  public:
+    virtual ~ConnectionLogic() { }
+
+  protected:
+    ConnectionRules profileRules;
+    RuleIndex profileIndex;
+
+    ConnectionRules observedRules;
+    RuleIndex observedIndex;
+
+    PortTable<ActivePort> activePorts;
+    std::array<ActiveClient, 256> activeClients;    // by client id
+    ConnectionGraph activeConnections;
+
+    ConnectionSet expectedDisconnects;
+    ConnectionSet expectedConnects;
+
+    unsigned int rulesGeneration = 0;
+    DecisionCache decisionCache;
+
+    std::vector<snd_seq_addr_t> newPorts;   // noted, but not yet connected
+
+  protected:
+    // The system being minded
+    virtual Address portAddress(const snd_seq_addr_t&) = 0;
+    virtual void connectPorts(const snd_seq_connect_t&) = 0;
+    virtual void disconnectPorts(const snd_seq_connect_t&) = 0;
+
+    // Changes to observedRules, so they can be saved: The rule at index is
+    // about to be removed, or the rule has just been added at the end.
+    virtual void observedRuleRemoved(std::size_t index, const ConnectionRule&) = 0;
+    virtual void observedRuleAdded(const ConnectionRule&) = 0;
+
+  protected:
+    void rulesChanged();
+    void observedRulesChanged();    // when only the observed rules have
+
+    void resetConnectionsSoft();
+    Reconciliation reconcileConnections();
+    Reconciliation updateConnections();
+
+    const Address& knownPort(snd_seq_addr_t addr);
+
+    void addPort(const snd_seq_addr_t& addr, bool fromReset = false);
+    ActivePort* notePort(const snd_seq_addr_t& addr, bool fromReset);
+    void connectPort(const ActivePort& ap);
+    void changePrimary(const snd_seq_addr_t&, bool asSender, bool primary);
+    void delPort(const snd_seq_addr_t& addr);
+    void delClient(client_id_t);    // drops all its ports at once
+    void clearPorts();
+
+    // Events from the system were lost: Those expected may never come, and
+    // any that do might be the user's, so stop expecting them, and forget
+    // the ports not yet connected. The caller then rescans the system.
+    void eventsLost();
+
+    // Ports announced in a burst are noted as each arrives, and then
+    // connected together once the burst has been read.
+    void addPortToBatch(const snd_seq_addr_t& addr);
+    void connectNewPorts();
+
+    // A client changed its name, or its ports did, without the kernel
+    // saying so: Note its ports again, as they are now, keeping the
+    // connections they have. Newly wanted connections are made by the
+    // next connectNewPorts().
+    void reviewClient(client_id_t, const std::vector<snd_seq_addr_t>& ports);
+
+    DecisionCache::Decision findRules(const Address&, const Address&);
+
+    void addConnection(const snd_seq_connect_t& conn);
+    void delConnection(const snd_seq_connect_t& conn);
+};
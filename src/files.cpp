@@ -13,6 +13,9 @@ namespace {
 
   std::string profileFilePath;
   std::string observedFilePath;
+  std::string observedJournalPath;
+  std::string profileCachePath;
+  std::string observedCachePath;
 
   std::string controlSocketPath;
 
@@ -62,6 +65,9 @@ namespace {
 
     profileFilePath   = stateDirPath + "/profile.rules";
     observedFilePath  = stateDirPath + "/observed.rules";
+    observedJournalPath = stateDirPath + "/observed.journal";
+    profileCachePath  = stateDirPath + "/profile.cache";
+    observedCachePath = stateDirPath + "/observed.cache";
 
     controlSocketPath = runtimeDirPath + "/control.socket";
   }
@@ -73,6 +79,9 @@ namespace Files {
 
   const std::string& profileFilePath()    { return ::profileFilePath; }
   const std::string& observedFilePath()   { return ::observedFilePath; }
+  const std::string& observedJournalPath() { return ::observedJournalPath; }
+  const std::string& profileCachePath()   { return ::profileCachePath; }
+  const std::string& observedCachePath()  { return ::observedCachePath; }
   const std::string& controlSocketPath()  { return ::controlSocketPath; }
 
   bool fileExists(const std::string& path) {
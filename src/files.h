@@ -9,6 +9,11 @@ namespace Files {
 
   const std::string& profileFilePath();
   const std::string& observedFilePath();
+  const std::string& observedJournalPath();   // see rulejournal.h
+
+  // compiled images of the above, see rulecache.h
+  const std::string& profileCachePath();
+  const std::string& observedCachePath();
 
   const std::string& controlSocketPath();
 
@@ -0,0 +1,100 @@
+#include "latency.h"
+
+#include <fmt/format.h>
+
+
+int Histogram::bucketOf(std::uint64_t v) {
+  if (v < subBuckets)
+    return int(v);
+
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - subBits;
+  return ((shift + 1) << subBits) + int((v >> shift) & (subBuckets - 1));
+}
+
+std::uint64_t Histogram::highestIn(int bucket) {
+  if (bucket < subBuckets)
+    return bucket;
+
+  int shift = (bucket >> subBits) - 1;
+  std::uint64_t low = subBuckets + (bucket & (subBuckets - 1));
+  return ((low + 1) << shift) - 1;
+}
+
+void Histogram::record(std::uint64_t ns) {
+  int b = bucketOf(ns);
+  if (b >= int(buckets.size()))
+    b = buckets.size() - 1;
+  buckets[b] += 1;
+  total += 1;
+  if (ns > largest)
+    largest = ns;
+}
+
+std::uint64_t Histogram::percentile(double p) const {
+  if (total == 0)
+    return 0;
+
+  auto wanted = std::uint64_t(p / 100.0 * total + 0.5);
+  if (wanted < 1) wanted = 1;
+
+  std::uint64_t seen = 0;
+  for (int b = 0; b < int(buckets.size()); ++b) {
+    seen += buckets[b];
+    if (seen >= wanted)
+      return std::min(highestIn(b), largest);
+  }
+  return largest;
+}
+
+
+namespace {
+  std::string duration(std::uint64_t ns) {
+    if (ns < 1000)        return fmt::format("{}ns", ns);
+    if (ns < 1000000)     return fmt::format("{:.1f}us", ns / 1e3);
+    if (ns < 1000000000)  return fmt::format("{:.1f}ms", ns / 1e6);
+    return fmt::format("{:.2f}s", ns / 1e9);
+  }
+
+  const char* headline = "PORT_START to connect";
+}
+
+void Latency::record(std::string_view what, Stamp since) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    Clock::now() - since).count();
+
+  // only the first of each name allocates
+  auto h = histograms.find(what);
+  if (h == histograms.end())
+    h = histograms.emplace(std::string(what), Histogram()).first;
+  h->second.record(ns > 0 ? ns : 0);
+}
+
+void Latency::summary(std::ostream& out) const {
+  auto i = histograms.find(headline);
+  if (i == histograms.end())
+    return;
+
+  auto& h = i->second;
+  out << fmt::format("{:>4} hotplug connections: {} median, {} p99, {} max\n",
+    h.count(), duration(h.percentile(50)), duration(h.percentile(99)),
+    duration(h.max()));
+}
+
+void Latency::report(std::ostream& out) const {
+  if (histograms.empty()) {
+    out << "No latencies recorded yet.\n";
+    return;
+  }
+
+  out << fmt::format("{:<26} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9}\n",
+    "", "count", "p50", "p90", "p99", "p99.9", "max");
+  for (auto& i : histograms) {
+    auto& h = i.second;
+    out << fmt::format("{:<26} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9}\n",
+      i.first, h.count(),
+      duration(h.percentile(50)), duration(h.percentile(90)),
+      duration(h.percentile(99)), duration(h.percentile(99.9)),
+      duration(h.max()));
+  }
+}
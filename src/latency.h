@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+
+// Histograms of how long things take, such as from a port being
+// announced to it being connected.
+//
+// Like HdrHistogram, each power of two is split into 32 linear buckets,
+// so any recorded value is known to within about 3%, from nanoseconds to
+// hours, in a fixed amount of space.
+
+class Histogram {
+  public:
+    void record(std::uint64_t ns);
+
+    std::uint64_t count() const { return total; }
+    std::uint64_t max() const { return largest; }
+    std::uint64_t percentile(double p) const;   // p in [0, 100]
+
+  private:
+    static constexpr int subBits = 5;
+    static constexpr int subBuckets = 1 << subBits;
+
+    static int bucketOf(std::uint64_t);
+    static std::uint64_t highestIn(int bucket);
+
+    std::array<std::uint32_t, 60 * subBuckets> buckets = { };
+    std::uint64_t total = 0;
+    std::uint64_t largest = 0;
+};
+
+
+class Latency {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Stamp = Clock::time_point;
+
+    // Records the time from since until now, under the given name.
+    void record(std::string_view what, Stamp since);
+
+    // One line summary of the most telling histogram, if it has anything.
+    void summary(std::ostream&) const;
+    // All of the histograms, with several percentiles each.
+    void report(std::ostream&) const;
+
+  private:
+    std::map<std::string, Histogram, std::less<>> histograms;
+};
@@ -0,0 +1,80 @@
+#include "names.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+
+
+namespace {
+  using Shared = std::shared_ptr<const std::string>;
+
+  // Keyed by the string, with a transparent comparison so that a lookup
+  // from a string_view needn't build a std::string to compare against.
+  // The table holds each string too, so that a name no longer referred to
+  // is still there when it comes back, as a device's names do each time it
+  // is plugged in. Entries only the table refers to are swept out when the
+  // table has grown to twice the size it was after the last sweep.
+
+  struct Table {
+    std::mutex mutex;
+    std::map<std::string, Shared, std::less<>> names;
+    std::size_t sweepAt = 64;
+
+    void sweep() {
+      for (auto i = names.begin(); i != names.end(); ) {
+        if (i->second.use_count() == 1)
+          i = names.erase(i);
+        else
+          ++i;
+      }
+      sweepAt = std::max<std::size_t>(64, names.size() * 2);
+    }
+  };
+
+  Table& table() {
+    // Names may be made while other files' statics are being constructed
+    static Table t;
+    return t;
+  }
+
+  Shared intern(std::string_view s) {
+    auto& t = table();
+    std::lock_guard<std::mutex> lock(t.mutex);
+
+    auto i = t.names.find(s);
+    if (i != t.names.end())
+      return i->second;
+
+    if (t.names.size() >= t.sweepAt)
+      t.sweep();
+
+    auto text = std::make_shared<const std::string>(s);
+    t.names.emplace(*text, text);
+    return text;
+  }
+
+  const Shared& emptyText() {
+    // not interned: it is always held here, so there is only ever the one
+    static const Shared empty = std::make_shared<const std::string>();
+    return empty;
+  }
+}
+
+
+Name::Name()                        : text(emptyText()) { }
+Name::Name(const char* s)           : Name(std::string_view(s)) { }
+Name::Name(const std::string& s)    : Name(std::string_view(s)) { }
+Name::Name(std::string_view s)
+  : text(s.empty() ? emptyText() : intern(s))
+  { }
+
+std::size_t Name::interned() {
+  auto& t = table();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  std::size_t n = 0;
+  for (auto& e : t.names)
+    if (e.second.use_count() > 1)
+      n += 1;
+  return n;
+}
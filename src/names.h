@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <fmt/format.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+
+// A client or port name, held once no matter how many Addresses, rules and
+// snapshots refer to it. Copying a Name copies a reference to the one shared
+// string, so it never allocates. As each distinct string is held only once,
+// two Names are equal exactly when they share it: Comparing them for
+// equality compares pointers.
+//
+// The strings live in an interning table for as long as any Name refers to
+// them, and for a while after, so that names which come and go needn't be
+// made again each time. The table may be used from any thread.
+
+class Name {
+  public:
+    Name();   // the empty string
+    Name(const char*);
+    Name(const std::string&);
+    explicit Name(std::string_view);
+
+    const std::string& str() const { return *text; }
+    operator const std::string&() const { return *text; }
+
+    bool empty() const        { return text->empty(); }
+    std::size_t size() const  { return text->size(); }
+
+    bool operator==(const Name& other) const { return text == other.text; }
+    bool operator!=(const Name& other) const { return text != other.text; }
+    bool operator<(const Name& other) const  { return *text < *other.text; }
+
+    static std::size_t interned();    // distinct strings currently in use
+
+  private:
+    std::shared_ptr<const std::string> text;
+};
+
+inline bool operator==(const Name& n, const std::string& s) { return n.str() == s; }
+inline bool operator!=(const Name& n, const std::string& s) { return n.str() != s; }
+inline bool operator==(const std::string& s, const Name& n) { return n.str() == s; }
+inline bool operator!=(const std::string& s, const Name& n) { return n.str() != s; }
+inline bool operator==(const Name& n, const char* s)        { return n.str() == s; }
+inline bool operator!=(const Name& n, const char* s)        { return n.str() != s; }
+
+
+template <> struct fmt::formatter<Name> : formatter<string_view> {
+  auto format(const Name& n, format_context& ctx) const
+    { return formatter<string_view>::format(n.str(), ctx); }
+};
+
+inline std::ostream& operator<<(std::ostream& s, const Name& n)
+  { return s << n.str(); }
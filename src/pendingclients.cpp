@@ -0,0 +1,117 @@
+#include "pendingclients.h"
+
+#include <algorithm>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "msg.h"
+
+
+PendingClients::PendingClients()
+  : firstRecheck(10), limit(200)
+{
+  // std::chrono::steady_clock is CLOCK_MONOTONIC
+  timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFD < 0)
+    throw Msg::system_error("timerfd_create failed");
+}
+
+PendingClients::~PendingClients() {
+  close(timerFD);
+}
+
+void PendingClients::configure(Duration f, Duration l) {
+  firstRecheck = std::max(f, Duration(1));
+  limit = l;
+}
+
+void PendingClients::add(client_id_t c) {
+  auto now = Clock::now();
+  clients[c] = { now, now + firstRecheck, firstRecheck, {} };
+  rearm();
+}
+
+bool PendingClients::has(client_id_t c) const {
+  return clients.find(c) != clients.end();
+}
+
+void PendingClients::remove(client_id_t c) {
+  if (clients.erase(c))
+    rearm();
+}
+
+void PendingClients::parkPort(const snd_seq_addr_t& addr) {
+  auto i = clients.find(addr.client);
+  if (i != clients.end())
+    i->second.ports.push_back(addr);
+}
+
+void PendingClients::unparkPort(const snd_seq_addr_t& addr) {
+  auto i = clients.find(addr.client);
+  if (i == clients.end())
+    return;
+
+  auto& ports = i->second.ports;
+  ports.erase(std::remove(ports.begin(), ports.end(), addr), ports.end());
+}
+
+std::vector<snd_seq_addr_t> PendingClients::release(client_id_t c) {
+  std::vector<snd_seq_addr_t> ports;
+  auto i = clients.find(c);
+  if (i == clients.end())
+    return ports;
+
+  ports.swap(i->second.ports);
+  clients.erase(i);
+  rearm();
+  return ports;
+}
+
+std::vector<client_id_t> PendingClients::due() {
+  uint64_t expirations;
+  while (read(timerFD, &expirations, sizeof(expirations)) > 0)
+    ;   // just clearing the fd's readable state
+
+  std::vector<client_id_t> ready;
+  auto now = Clock::now();
+  for (auto& c : clients)
+    if (c.second.nextCheck <= now)
+      ready.push_back(c.first);
+  return ready;
+}
+
+bool PendingClients::recheckLater(client_id_t c) {
+  auto i = clients.find(c);
+  if (i == clients.end())
+    return false;
+
+  auto& client = i->second;
+  auto now = Clock::now();
+  auto giveUpAt = client.started + limit;
+  if (now >= giveUpAt)
+    return false;
+
+  client.interval *= 2;
+  client.nextCheck = std::min(now + client.interval, giveUpAt);
+  rearm();
+  return true;
+}
+
+void PendingClients::rearm() {
+  struct itimerspec spec = { };   // all zero disarms the timer
+
+  if (!clients.empty()) {
+    auto next = std::min_element(clients.begin(), clients.end(),
+      [](auto& a, auto& b){ return a.second.nextCheck < b.second.nextCheck; }
+    )->second.nextCheck;
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      next.time_since_epoch()).count();
+    if (ns <= 0) ns = 1;    // zero would disarm
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+  }
+
+  if (timerfd_settime(timerFD, TFD_TIMER_ABSTIME, &spec, nullptr) != 0)
+    throw Msg::system_error("timerfd_settime failed");
+}
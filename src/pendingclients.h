@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "seq.h"
+
+
+// Clients that the kernel announced before they set their name, and the
+// ports they have created in the mean time.
+//
+// The kernel names a new client "Client-N", and most clients rename
+// themselves before doing anything else. Some create their ports first.
+// Rules are matched by name, so such ports are held back until either the
+// client is renamed, or it has been given long enough. Each client is
+// rechecked on a timer, with the interval doubling each time; the timer is
+// a timerfd, so it can sit in the daemon's epoll set.
+
+class PendingClients {
+  public:
+    using Duration = std::chrono::milliseconds;
+
+    PendingClients();
+    ~PendingClients();
+
+    // firstRecheck is the first interval; limit is the longest to wait in
+    // all. A limit of zero means clients are never held.
+    void configure(Duration firstRecheck, Duration limit);
+    bool enabled() const { return limit.count() > 0; }
+
+    int fd() const { return timerFD; }
+
+    void add(client_id_t);
+    bool has(client_id_t) const;
+    void remove(client_id_t);
+
+    void parkPort(const snd_seq_addr_t&);
+    void unparkPort(const snd_seq_addr_t&);
+
+    // Stops holding the client, returning its parked ports, in the order
+    // they were created.
+    std::vector<snd_seq_addr_t> release(client_id_t);
+
+    // Call when fd() is readable. Returns the clients due to be rechecked.
+    std::vector<client_id_t> due();
+
+    // For a client returned by due(), that still doesn't have a name:
+    // Schedules the next check, or returns false if it has waited long
+    // enough and should be released as is.
+    bool recheckLater(client_id_t);
+
+    std::size_t size() const { return clients.size(); }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Client {
+      Clock::time_point started;
+      Clock::time_point nextCheck;
+      Duration interval;
+      std::vector<snd_seq_addr_t> ports;
+    };
+
+    int timerFD;
+    Duration firstRecheck;
+    Duration limit;
+    std::map<client_id_t, Client> clients;
+
+    void rearm();
+
+    PendingClients(const PendingClients&) = delete;
+    PendingClients& operator=(const PendingClients&) = delete;
+};
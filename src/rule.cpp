@@ -1,6 +1,7 @@
 #include "rule.h"
 
-#include <regex>
+#include <algorithm>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -70,8 +71,8 @@ ClientSpec ClientSpec::wildcard()
 
 bool ClientSpec::match(const Address& a) const {
   switch (kind) {
-    case Partial:   return a.client.find(client) != std::string::npos;
-    case Exact:     return a.client == client;
+    case Partial:   return a.client.str().find(client.str()) != std::string::npos;
+    case Exact:     return a.client == client;    // both interned
     case Numeric:   return a.addr.client == clientNum;
     case Wildcard:  return true;
   }
@@ -81,10 +82,19 @@ bool ClientSpec::match(const Address& a) const {
 bool ClientSpec::isWildcard() const
   { return kind == Wildcard; }
 
+bool ClientSpec::isExact() const
+  { return kind == Exact; }
+
+bool ClientSpec::isPartial() const
+  { return kind == Partial; }
+
+bool ClientSpec::isNumeric() const
+  { return kind == Numeric; }
+
 fmt::format_context::iterator
 ClientSpec::format(fmt::format_context& ctx) const {
   switch (kind) {
-    case Partial:   return string_to(ctx.out(), client);
+    case Partial:   return string_to(ctx.out(), client.str());
     case Exact:     return fmt::format_to(ctx.out(), "\"{}\"", client);
     case Numeric:   return fmt::format_to(ctx.out(), "{:d}", clientNum);
     case Wildcard:  return string_to(ctx.out(), "*");
@@ -124,6 +134,15 @@ bool PortSpec::isType() const
 bool PortSpec::isWildcard() const
   { return kind == Wildcard; }
 
+bool PortSpec::isPartial() const
+  { return kind == Partial; }
+
+bool PortSpec::isExact() const
+  { return kind == Exact; }
+
+bool PortSpec::isNumeric() const
+  { return kind == Numeric; }
+
 bool PortSpec::matchAsSender(const Address& a) const {
   return a.canBeSender() && match(a, a.primarySender);
 }
@@ -135,7 +154,7 @@ bool PortSpec::matchAsDest(const Address& a) const {
 bool PortSpec::match(const Address& a, bool primaryFlag) const {
   switch (kind) {
     case Defaulted:   return primaryFlag;
-    case Partial:     return a.port.find(port) != std::string::npos
+    case Partial:     return a.port.str().find(port.str()) != std::string::npos
                               || a.portLong == port; // just in case...
     case Exact:       return a.port == port || a.portLong == port;
     case Numeric:     return a.addr.port == portNum;
@@ -149,7 +168,7 @@ fmt::format_context::iterator
 PortSpec::format(fmt::format_context& ctx) const {
   switch (kind) {
     case Defaulted:   break;
-    case Partial:     return string_to(ctx.out(), port);
+    case Partial:     return string_to(ctx.out(), port.str());
     case Exact:       return fmt::format_to(ctx.out(), "\"{}\"", port);
     case Numeric:     return fmt::format_to(ctx.out(), "{}", portNum);
     case Type:
@@ -214,124 +233,236 @@ namespace {
   class ParseError : public std::runtime_error {
     public:
       template <typename... T>
-      ParseError(const char* format, const T&... args)
-        : std::runtime_error(fmt::format(format, args...))
+      ParseError(std::size_t col, const char* format, const T&... args)
+        : std::runtime_error(fmt::format(format, args...)), column(col)
         { }
+
+      const std::size_t column;   // zero based, from the start of the line
+  };
+
+  // A piece of the line being parsed, and where in the line it starts.
+  struct Span {
+    std::string_view text;
+    std::size_t column;
+
+    bool empty() const { return text.empty(); }
+    std::size_t size() const { return text.size(); }
+    char operator[](std::size_t i) const { return text[i]; }
+    char front() const { return text.front(); }
+
+    Span sub(std::size_t pos, std::size_t n = std::string_view::npos) const
+      { return Span{text.substr(pos, n), column + pos}; }
+    std::string str() const { return std::string(text); }
   };
 
-  ClientSpec parseClientSpec(const std::string& s) {
-    std::smatch m;
+  inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n'
+      || c == '\v' || c == '\f' || c == '\r';
+  }
+  inline bool isDigit(char c) { return '0' <= c && c <= '9'; }
+  inline bool isWordChar(char c) {
+    return isDigit(c) || c == '_'
+      || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+  }
 
-    static const std::regex clientRE(
-      "(\\*)|\"([^\"]+)\"|\'([^\']+)\'|([^*\"'=.].*)");
-    if (!std::regex_match(s, m, clientRE))
-      throw ParseError("malformed client '{}'", s);
+  bool allDigits(std::string_view s) {
+    if (s.empty()) return false;
+    for (char c : s)
+      if (!isDigit(c)) return false;
+    return true;
+  }
 
-    if (m.str(1).size())  return ClientSpec::wildcard();
-    if (m.str(2).size())  return ClientSpec::exact(m.str(2));
-    if (m.str(3).size())  return ClientSpec::exact(m.str(3));
-    if (m.str(4).size())  return ClientSpec::partial(m.str(4));
+  // "..." or '...', with at least one character, and no inner quote
+  bool isQuoted(std::string_view s) {
+    if (s.size() < 3) return false;
+    char q = s.front();
+    if (q != '"' && q != '\'') return false;
+    return s.find(q, 1) == s.size() - 1;
+  }
 
-    throw ParseError("parseClientSpec match failure with '{}'", s);
-      // shouldn't ever happen!
+  // may start an unquoted name: anything but the characters that begin
+  // the other forms
+  bool startsName(char c) {
+    return c != '*' && c != '"' && c != '\'' && c != '=' && c != '.';
   }
 
-  PortSpec parsePortSpec(const std::string& s) {
-    std::smatch m;
+  // may start an unquoted client or port in an address
+  bool startsUnquoted(char c) {
+    return c != '"' && c != '\'' && c != ':';
+  }
 
-    static const std::regex portRE(
-      "(\\*)|\"([^\"]+)\"|\'([^\']+)\'|=(\\d+)|([^*\"'=.].*)");
-    if (!std::regex_match(s, m, portRE))
-      throw ParseError("malformed port '{}'", s);
+  // length of a leading "..." or '...' in s, or 0 if there isn't one
+  std::size_t quotedLength(std::string_view s) {
+    if (s.empty() || (s.front() != '"' && s.front() != '\'')) return 0;
+    auto close = s.find(s.front(), 1);
+    if (close == std::string_view::npos || close == 1) return 0;
+    return close + 1;
+  }
 
-    if (m.str(1).size())  return PortSpec::wildcard();
-    if (m.str(2).size())  return PortSpec::exact(m.str(2));
-    if (m.str(3).size())  return PortSpec::exact(m.str(3));
-    if (m.str(4).size())  return PortSpec::numeric(std::stoi(m.str(4)));
-    if (m.str(5).size())  return PortSpec::partial(m.str(5));
+  // one of "-->", "-x->", "<--", "<-->", "<-x-", "<-x->", with any number
+  // of dashes in each run
+  bool isArrow(std::string_view t) {
+    std::size_t i = 0;
+    bool fromRight = i < t.size() && t[i] == '<';
+    if (fromRight) i += 1;
+
+    auto dashes = [&]() {
+      std::size_t start = i;
+      while (i < t.size() && t[i] == '-') i += 1;
+      return i > start;
+    };
+
+    if (!dashes()) return false;
+    if (i < t.size() && t[i] == 'x') {
+      i += 1;
+      if (!dashes()) return false;
+    }
+    bool toRight = i < t.size() && t[i] == '>';
+    if (toRight) i += 1;
 
-    throw ParseError("parsePortSpec match failure with '{}'", s);
-      // shouldn't ever happen!
+    return i == t.size() && (fromRight || toRight);
   }
 
-  AddressSpec parseAddressSpec(const std::string& s, bool allowIDs = false) {
-    std::smatch m;
 
-    static const std::regex idsRE("(\\d+):(\\d+)");
-    if (std::regex_match(s, m, idsRE)) {
+  ClientSpec parseClientSpec(const Span& s) {
+    if (s.text == "*")        return ClientSpec::wildcard();
+    if (isQuoted(s.text))     return ClientSpec::exact(s.sub(1, s.size() - 2).str());
+    if (!s.empty() && startsName(s.front()))
+                              return ClientSpec::partial(s.str());
+
+    throw ParseError(s.column, "malformed client '{}'", s.text);
+  }
+
+  PortSpec parsePortSpec(const Span& s) {
+    if (s.text == "*")        return PortSpec::wildcard();
+    if (isQuoted(s.text))     return PortSpec::exact(s.sub(1, s.size() - 2).str());
+    if (!s.empty() && s.front() == '=' && allDigits(s.text.substr(1)))
+                              return PortSpec::numeric(std::stoi(s.sub(1).str()));
+    if (!s.empty() && startsName(s.front()))
+                              return PortSpec::partial(s.str());
+
+    throw ParseError(s.column, "malformed port '{}'", s.text);
+  }
+
+  AddressSpec parseAddressSpec(const Span& s, bool allowIDs = false) {
+    auto colon = s.text.find(':');
+
+    if (colon != std::string_view::npos
+        && allDigits(s.text.substr(0, colon))
+        && allDigits(s.text.substr(colon + 1))) {
       if (!allowIDs)
-        throw ParseError("client-id:port-id matches not allowed here");
-      auto c = ClientSpec::numeric(std::stoi(m.str(1)));
-      auto p = PortSpec::numeric(std::stoi(m.str(2)));
+        throw ParseError(s.column,
+          "client-id:port-id matches not allowed here");
+      auto c = ClientSpec::numeric(std::stoi(s.sub(0, colon).str()));
+      auto p = PortSpec::numeric(std::stoi(s.sub(colon + 1).str()));
       return AddressSpec(c, p);
     }
 
-    static const std::regex portTypeRE("\\.\\w+");
-    if (std::regex_match(s, m, portTypeRE)) {
+    if (s.size() > 1 && s.front() == '.'
+        && std::all_of(s.text.begin() + 1, s.text.end(), isWordChar)) {
       unsigned int type = 0;
-      if      (s == ".hw")    type = SND_SEQ_PORT_TYPE_HARDWARE;
-      else if (s == ".app")   type = SND_SEQ_PORT_TYPE_APPLICATION;
+      if      (s.text == ".hw")   type = SND_SEQ_PORT_TYPE_HARDWARE;
+      else if (s.text == ".app")  type = SND_SEQ_PORT_TYPE_APPLICATION;
       else
-        throw ParseError("invalid port type '{}'", s);
+        throw ParseError(s.column, "invalid port type '{}'", s.text);
 
       return AddressSpec(ClientSpec::wildcard(), PortSpec::type(type));
     }
 
-    static const std::regex addressRE(
-          "([^\"':][^:]*|\"[^\"]+\"|\'[^\']+\')"
-        "(:([^\"':][^:]*|\"[^\"]+\"|\'[^\']+\'))?");
-    if (!std::regex_match(s, m, addressRE))
-      throw ParseError("malformed address '{}'", s);
+    // client is quoted, or runs up to the first colon
+    std::size_t clientLen = quotedLength(s.text);
+    if (clientLen == 0) {
+      if (s.empty() || !startsUnquoted(s.front()))
+        throw ParseError(s.column, "malformed address '{}'", s.text);
+      clientLen = std::min(colon, s.size());
+    }
 
-    ClientSpec cs = parseClientSpec(m.str(1));
-    PortSpec ps =
-      m.str(2).empty()
-        ? (cs.isWildcard()? PortSpec::wildcard() : PortSpec::defaulted())
-        : parsePortSpec(m.str(3));
+    Span client = s.sub(0, clientLen);
+    Span rest = s.sub(clientLen);
 
+    if (rest.empty()) {
+      ClientSpec cs = parseClientSpec(client);
+      return AddressSpec(cs,
+        cs.isWildcard() ? PortSpec::wildcard() : PortSpec::defaulted());
+    }
+
+    // port is quoted, or is everything after the colon, with no more colons
+    Span port = rest.sub(1);
+    bool wellFormed =
+      rest.front() == ':'
+      && (quotedLength(port.text) > 0
+          ? quotedLength(port.text) == port.size()
+          : !port.empty() && startsUnquoted(port.front())
+            && port.text.find(':') == std::string_view::npos);
+    if (!wellFormed)
+      throw ParseError(s.column, "malformed address '{}'", s.text);
+
+    ClientSpec cs = parseClientSpec(client);
+    PortSpec ps = parsePortSpec(port);
     return AddressSpec(cs, ps);
   }
 
-  ConnectionRules parseConnectionRule(const std::string& s) {
-    std::smatch m;
-
-    static const std::regex ruleRE("(.*?)\\s+(-+(?:x-+)?>|<-+(?:x-+)?>?)\\s+(.*)");
-    if (!std::regex_match(s, m, ruleRE))
-      throw ParseError("malformed rule '{}'", s);
+  ConnectionRules parseConnectionRule(const Span& s) {
+    // the arrow is the first word, after the first, that is an arrow and
+    // has something after it; the endpoints are what is on either side
 
-    AddressSpec left = parseAddressSpec(m.str(1));
-    AddressSpec right = parseAddressSpec(m.str(3));
+    std::size_t i = 0;
+    while (i < s.size() && !isSpace(s[i])) i += 1;
 
-    ConnectionRules rules;
-    std::string type = m.str(2);
-    if (type.empty())
-      throw ParseError("parseConnectionRule match failure with '{}'", s);
-        // should never happen, because ruleRE ensures at least one character
+    while (i < s.size()) {
+      std::size_t spaceStart = i;
+      while (i < s.size() && isSpace(s[i])) i += 1;
+      std::size_t wordStart = i;
+      while (i < s.size() && !isSpace(s[i])) i += 1;
+      std::size_t wordEnd = i;
 
-    bool blocking = type.find('x') != std::string::npos;
-    if (type.back() == '>')   rules.push_back(ConnectionRule(left, right, blocking));
-    if (type.front() == '<')  rules.push_back(ConnectionRule(right, left, blocking));
+      if (wordEnd == s.size() || !isArrow(s.text.substr(wordStart, wordEnd - wordStart)))
+        continue;
 
-    return rules;
-  }
+      std::size_t rightStart = wordEnd;
+      while (rightStart < s.size() && isSpace(s[rightStart])) rightStart += 1;
 
-  ConnectionRules parseLine(const std::string& line) {
-    std::smatch m;
+      AddressSpec left = parseAddressSpec(s.sub(0, spaceStart));
+      AddressSpec right = parseAddressSpec(s.sub(rightStart));
 
-    std::string ruleUntrimmed = line;
-    bool expect_failure = false;
+      std::string_view type = s.text.substr(wordStart, wordEnd - wordStart);
+      bool blocking = type.find('x') != std::string_view::npos;
 
-    static const std::regex decomment("([^#]*)#(.*)");
-    if (std::regex_match(line, m, decomment)) {
-      ruleUntrimmed = m.str(1);
-      expect_failure = m.str(2).find("FAIL") != std::string::npos;
+      ConnectionRules rules;
+      if (type.back() == '>')   rules.push_back(ConnectionRule(left, right, blocking));
+      if (type.front() == '<')  rules.push_back(ConnectionRule(right, left, blocking));
+      return rules;
     }
 
-    std::string rule = ruleUntrimmed;
+    throw ParseError(s.column, "malformed rule '{}'", s.text);
+  }
+
+  ConnectionRules parseLine(std::string_view line) {
+    std::string_view ruleUntrimmed = line;
+    bool expect_failure = false;
+    std::size_t expect_column = 0;    // one based, zero if not given
+
+    auto hash = line.find('#');
+    if (hash != std::string_view::npos) {
+      ruleUntrimmed = line.substr(0, hash);
+      auto comment = line.substr(hash + 1);
+      auto fail = comment.find("FAIL");
+      expect_failure = fail != std::string_view::npos;
+
+      // "FAIL at column N" also says where the error should be found
+      constexpr std::string_view atColumn = "FAIL at column ";
+      if (expect_failure
+          && comment.compare(fail, atColumn.size(), atColumn) == 0)
+        for (auto i = fail + atColumn.size();
+            i < comment.size() && isDigit(comment[i]); ++i)
+          expect_column = expect_column * 10 + (comment[i] - '0');
+    }
 
-    static const std::regex trimWhitespace("\\s*(.*?)\\s*");
-    if (std::regex_match(ruleUntrimmed, m, trimWhitespace))
-      rule = m.str(1);
+    std::size_t start = 0;
+    std::size_t end = ruleUntrimmed.size();
+    while (start < end && isSpace(ruleUntrimmed[start]))  start += 1;
+    while (start < end && isSpace(ruleUntrimmed[end - 1])) end -= 1;
+    Span rule{ruleUntrimmed.substr(start, end - start), start};
 
     ConnectionRules r;
     if (rule.empty()) return r;
@@ -340,19 +471,22 @@ namespace {
       r = parseConnectionRule(rule);
     }
     catch (const ParseError& p) {
-      if (expect_failure) return r;
-      throw;
+      if (!expect_failure) throw;
+      if (expect_column && p.column + 1 != expect_column)
+        throw ParseError(p.column, "failed here, not at column {}: {}",
+          expect_column, p.what());
+      return r;
     }
 
     if (expect_failure)
-      throw ParseError("was not expected to parse");
+      throw ParseError(rule.column, "was not expected to parse");
     return r;
   }
 
 }
 
 AddressSpec AddressSpec::parse(const std::string& s, bool allowIDs) {
-  return parseAddressSpec(s, allowIDs);
+  return parseAddressSpec(Span{s, 0}, allowIDs);
 }
 
 bool parseRules(std::istream& input, ConnectionRules& rules) {
@@ -364,7 +498,8 @@ bool parseRules(std::istream& input, ConnectionRules& rules) {
       rules.insert(rules.end(), newRules.begin(), newRules.end());
     }
     catch (const ParseError& p) {
-      Msg::error("Parse error on line {}: {}", lineNo, p.what());
+      Msg::error("Parse error on line {}, column {}: {}",
+        lineNo, p.column + 1, p.what());
       good = false;
     }
   }
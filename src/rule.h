@@ -21,6 +21,14 @@ class ClientSpec {
     ClientSpec& operator=(const ClientSpec&) = default;
 
     bool isWildcard() const;
+    bool isExact() const;
+    bool isPartial() const;
+    bool isNumeric() const;
+    const std::string& name() const { return client.str(); }
+      // only meaningful for partial and exact specs
+    int number() const { return clientNum; }
+      // only meaningful for numeric specs
+
     fmt::format_context::iterator format(fmt::format_context&) const;
 
   private:
@@ -32,7 +40,7 @@ class ClientSpec {
     };
 
     Kind kind;
-    std::string client;
+    Name client;
     int clientNum;
 
     ClientSpec(Kind, const std::string&, int);
@@ -56,6 +64,15 @@ class PortSpec {
     bool isDefaulted() const;
     bool isType() const;
     bool isWildcard() const;
+    bool isPartial() const;
+    bool isExact() const;
+    bool isNumeric() const;
+    const std::string& name() const { return port.str(); }
+      // only meaningful for partial and exact specs
+    int number() const { return portNum; }
+      // only meaningful for numeric specs
+    unsigned int typeFlags() const { return typeFlag; }
+      // only meaningful for type specs
 
     fmt::format_context::iterator format(fmt::format_context&) const;
 
@@ -70,7 +87,7 @@ class PortSpec {
     };
 
     Kind kind;
-    std::string port;
+    Name port;
     bool exactMatch;
     int portNum;
     unsigned int typeFlag;
@@ -95,6 +112,9 @@ class AddressSpec {
 
     bool isWildcard() const;
 
+    const ClientSpec& clientSpec() const  { return client; }
+    const PortSpec& portSpec() const      { return port; }
+
     fmt::format_context::iterator format(fmt::format_context&) const;
 
     static AddressSpec parse(const std::string&, bool allowIDs);
@@ -114,6 +134,9 @@ class ConnectionRule {
 
     bool isBlockingRule() const { return blocking; }
 
+    const AddressSpec& senderSpec() const   { return sender; }
+    const AddressSpec& destSpec() const     { return dest; }
+
     bool senderMatch(const Address& a) const   { return sender.matchAsSender(a); }
     bool destMatch(const Address& a) const     { return dest.matchAsDest(a); }
     bool match(const Address& s, const Address& d) const
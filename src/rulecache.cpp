@@ -0,0 +1,362 @@
+#include "rulecache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "files.h"
+#include "msg.h"
+
+
+/*
+
+== image layout
+
+All fields are in host byte order: The image is only ever read back by the
+machine that wrote it.
+
+    Header
+    Entry     strings[stringCount]  -- offset & length of each string in text
+    Rule      rules[ruleCount]
+    char      text[textLength]      -- contents of all the strings, unterminated
+
+Each distinct client or port name is stored once, and rules refer to it by
+index into strings.
+
+*/
+
+namespace {
+
+  const char imageMagic[8] = { 'm', 'm', 'r', 'u', 'l', 'e', 's', '\0' };
+  const uint32_t imageVersion = 1;
+
+  struct Header {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  stringCount;
+    uint32_t  ruleCount;
+    uint32_t  textLength;
+    uint64_t  sourceSize;
+    int64_t   sourceMTimeSec;
+    int64_t   sourceMTimeNSec;
+    uint64_t  sourceHash;
+    uint64_t  bodyHash;     // of everything after the header
+  };
+
+  struct Entry {
+    uint32_t  offset;
+    uint32_t  length;
+  };
+
+  enum Tag : uint8_t {
+    TagDefaulted,
+    TagPartial,
+    TagExact,
+    TagNumeric,
+    TagType,
+    TagWildcard,
+  };
+
+  struct Endpoint {
+    uint8_t   clientTag;
+    uint8_t   portTag;
+    uint16_t  unused;
+    uint32_t  clientValue;    // string index, or client number
+    uint32_t  portValue;      // string index, port number, or type flags
+  };
+
+  struct Rule {
+    Endpoint  sender;
+    Endpoint  dest;
+    uint32_t  blocking;
+  };
+
+
+  // What the image was compiled from.
+  struct Source {
+    uint64_t  size;
+    int64_t   mtimeSec;
+    int64_t   mtimeNSec;
+    uint64_t  hash;
+  };
+
+  uint64_t hashBytes(const char* p, std::size_t n) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (; n; --n, ++p) {
+      h ^= static_cast<unsigned char>(*p);
+      h *= 0x100000001b3ull;
+    }
+    return h;
+  }
+
+  bool sourceOf(const std::string& textPath, const std::string& text,
+    Source& source)
+  {
+    struct stat statbuf;
+    if (stat(textPath.c_str(), &statbuf) != 0)
+      return false;
+    if (static_cast<uint64_t>(statbuf.st_size) != text.size())
+      return false;   // file changed since it was read
+
+    source.size = text.size();
+    source.mtimeSec = statbuf.st_mtim.tv_sec;
+    source.mtimeNSec = statbuf.st_mtim.tv_nsec;
+    source.hash = hashBytes(text.data(), text.size());
+    return true;
+  }
+
+
+  class MappedFile {
+    public:
+      MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        struct stat statbuf;
+        if (fstat(fd, &statbuf) == 0 && statbuf.st_size > 0) {
+          void* p = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (p != MAP_FAILED) {
+            addr = p;
+            len = statbuf.st_size;
+          }
+        }
+        close(fd);
+      }
+
+      ~MappedFile() {
+        if (addr) munmap(addr, len);
+      }
+
+      const char* data() const  { return static_cast<const char*>(addr); }
+      std::size_t size() const  { return len; }
+
+    private:
+      void* addr = nullptr;
+      std::size_t len = 0;
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+  };
+
+
+  class ImageWriter {
+    public:
+      std::string image(const Source& source, const ConnectionRules& rules) {
+        for (auto& r : rules)
+          this->rules.push_back(
+            { endpoint(r.senderSpec()), endpoint(r.destSpec()),
+              r.isBlockingRule() });
+
+        Header header = { };
+        std::memcpy(header.magic, imageMagic, sizeof(imageMagic));
+        header.version = imageVersion;
+        header.stringCount = entries.size();
+        header.ruleCount = this->rules.size();
+        header.textLength = text.size();
+        header.sourceSize = source.size;
+        header.sourceMTimeSec = source.mtimeSec;
+        header.sourceMTimeNSec = source.mtimeNSec;
+        header.sourceHash = source.hash;
+
+        std::string body;
+        append(body, entries.data(), entries.size() * sizeof(Entry));
+        append(body, this->rules.data(), this->rules.size() * sizeof(Rule));
+        body += text;
+        header.bodyHash = hashBytes(body.data(), body.size());
+
+        std::string out;
+        append(out, &header, sizeof(header));
+        return out + body;
+      }
+
+    private:
+      std::map<std::string, uint32_t> interned;
+      std::vector<Entry> entries;
+      std::vector<Rule> rules;
+      std::string text;
+
+      static void append(std::string& out, const void* p, std::size_t n) {
+        out.append(static_cast<const char*>(p), n);
+      }
+
+      uint32_t intern(const std::string& s) {
+        auto i = interned.find(s);
+        if (i != interned.end())
+          return i->second;
+
+        uint32_t index = entries.size();
+        entries.push_back({ static_cast<uint32_t>(text.size()),
+                            static_cast<uint32_t>(s.size()) });
+        text += s;
+        interned.emplace(s, index);
+        return index;
+      }
+
+      Endpoint endpoint(const AddressSpec& a) {
+        Endpoint e = { };
+
+        auto& c = a.clientSpec();
+        if      (c.isWildcard())  { e.clientTag = TagWildcard; }
+        else if (c.isExact())     { e.clientTag = TagExact;   e.clientValue = intern(c.name()); }
+        else if (c.isPartial())   { e.clientTag = TagPartial; e.clientValue = intern(c.name()); }
+        else if (c.isNumeric())   { e.clientTag = TagNumeric; e.clientValue = c.number(); }
+        else
+          throw Msg::runtime_error("unknown client spec kind in {}", a);
+
+        auto& p = a.portSpec();
+        if      (p.isDefaulted()) { e.portTag = TagDefaulted; }
+        else if (p.isWildcard())  { e.portTag = TagWildcard; }
+        else if (p.isExact())     { e.portTag = TagExact;   e.portValue = intern(p.name()); }
+        else if (p.isPartial())   { e.portTag = TagPartial; e.portValue = intern(p.name()); }
+        else if (p.isNumeric())   { e.portTag = TagNumeric; e.portValue = p.number(); }
+        else if (p.isType())      { e.portTag = TagType;    e.portValue = p.typeFlags(); }
+        else
+          throw Msg::runtime_error("unknown port spec kind in {}", a);
+
+        return e;
+      }
+  };
+
+
+  class ImageReader {
+    public:
+      ImageReader(const char* data, std::size_t size) : data(data), size(size) { }
+
+      // Returns an empty string on success, otherwise why the image is unusable
+      std::string read(const Source& source, ConnectionRules& rules) {
+        if (size < sizeof(Header))
+          return "too short";
+
+        Header header;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, imageMagic, sizeof(imageMagic)) != 0)
+          return "not a rules image";
+        if (header.version != imageVersion)
+          return "different version";
+        if (header.sourceSize != source.size
+            || header.sourceMTimeSec != source.mtimeSec
+            || header.sourceMTimeNSec != source.mtimeNSec
+            || header.sourceHash != source.hash)
+          return "stale";
+
+        std::size_t entriesAt = sizeof(Header);
+        std::size_t rulesAt = entriesAt + std::size_t(header.stringCount) * sizeof(Entry);
+        textAt = rulesAt + std::size_t(header.ruleCount) * sizeof(Rule);
+        textLength = header.textLength;
+        if (textAt + textLength != size)
+          return "wrong size";
+        if (hashBytes(data + sizeof(Header), size - sizeof(Header)) != header.bodyHash)
+          return "damaged";
+
+        strings.resize(header.stringCount);
+        for (std::size_t i = 0; i < strings.size(); ++i)
+          std::memcpy(&strings[i], data + entriesAt + i * sizeof(Entry), sizeof(Entry));
+        for (auto& e : strings)
+          if (e.offset > textLength || e.length > textLength - e.offset)
+            return "bad string entry";
+
+        ConnectionRules newRules;
+        newRules.reserve(header.ruleCount);
+        for (std::size_t i = 0; i < header.ruleCount; ++i) {
+          Rule r;
+          std::memcpy(&r, data + rulesAt + i * sizeof(Rule), sizeof(Rule));
+          try {
+            newRules.push_back(ConnectionRule(
+              address(r.sender), address(r.dest), r.blocking != 0));
+          }
+          catch (const std::out_of_range&) {
+            return "bad rule";
+          }
+        }
+
+        rules.swap(newRules);
+        return std::string();
+      }
+
+    private:
+      const char* data;
+      std::size_t size;
+      std::size_t textAt = 0;
+      std::size_t textLength = 0;
+      std::vector<Entry> strings;
+
+      std::string string(uint32_t index) {
+        const Entry& e = strings.at(index);
+        return std::string(data + textAt + e.offset, e.length);
+      }
+
+      AddressSpec address(const Endpoint& e) {
+        auto client = [&]() {
+          switch (e.clientTag) {
+            case TagPartial:  return ClientSpec::partial(string(e.clientValue));
+            case TagExact:    return ClientSpec::exact(string(e.clientValue));
+            case TagNumeric:  return ClientSpec::numeric(e.clientValue);
+            case TagWildcard: return ClientSpec::wildcard();
+          }
+          throw std::out_of_range("client tag");
+        };
+        auto port = [&]() {
+          switch (e.portTag) {
+            case TagDefaulted:  return PortSpec::defaulted();
+            case TagPartial:    return PortSpec::partial(string(e.portValue));
+            case TagExact:      return PortSpec::exact(string(e.portValue));
+            case TagNumeric:    return PortSpec::numeric(e.portValue);
+            case TagType:       return PortSpec::type(e.portValue);
+            case TagWildcard:   return PortSpec::wildcard();
+          }
+          throw std::out_of_range("port tag");
+        };
+        return AddressSpec(client(), port());
+      }
+  };
+}
+
+
+namespace RuleCache {
+
+  bool load(const std::string& cachePath,
+    const std::string& textPath, const std::string& text,
+    ConnectionRules& rules)
+  {
+    Source source;
+    if (!sourceOf(textPath, text, source))
+      return false;
+
+    MappedFile image(cachePath);
+    if (!image.data()) {
+      Msg::detail("Rules cache {} not present", cachePath);
+      return false;
+    }
+
+    std::string problem = ImageReader(image.data(), image.size()).read(source, rules);
+    if (!problem.empty()) {
+      Msg::detail("Rules cache {} not used: {}", cachePath, problem);
+      return false;
+    }
+    return true;
+  }
+
+  void save(const std::string& cachePath,
+    const std::string& textPath, const std::string& text,
+    const ConnectionRules& rules)
+  {
+    Source source;
+    if (!sourceOf(textPath, text, source))
+      return;
+
+    try {
+      Files::writeFile(cachePath, ImageWriter().image(source, rules));
+    }
+    catch (const std::exception& e) {
+      Msg::error("Could not write rules cache {}: {}", cachePath, e.what());
+    }
+  }
+
+}
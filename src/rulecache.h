@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "rule.h"
+
+
+// A compiled image of a rules file, kept next to it in the state directory,
+// so that the daemon doesn't have to parse the text each time it starts.
+// The image records the size, modification time and hash of the text it
+// was compiled from, and is only used while all three still match.
+
+namespace RuleCache {
+  // Fills rules from the image at cachePath, if it is valid for the rules
+  // file at textPath, whose contents are text. Returns false, leaving rules
+  // untouched, if there is no image, or it is stale or damaged.
+  bool load(const std::string& cachePath,
+    const std::string& textPath, const std::string& text,
+    ConnectionRules& rules);
+
+  // Writes the image of rules, as parsed from the contents of textPath.
+  // Failure is reported, but not fatal: The text is always authoritative.
+  void save(const std::string& cachePath,
+    const std::string& textPath, const std::string& text,
+    const ConnectionRules& rules);
+}
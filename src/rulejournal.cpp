@@ -0,0 +1,177 @@
+#include "rulejournal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "files.h"
+#include "msg.h"
+
+
+namespace {
+
+  std::string header(const std::string& snapshot) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : snapshot) {
+      h ^= c;
+      h *= 0x100000001b3ull;
+    }
+    return fmt::format("# midiminder rules journal, for {} bytes, hash {:016x}",
+      snapshot.size(), h);
+  }
+
+  bool replay(const std::string& path, const std::string& line,
+    ConnectionRules& rules)
+  {
+    if (line.compare(0, 2, "+ ") == 0) {
+      ConnectionRules parsed;
+      if (parseRules(line.substr(2), parsed)) {
+        rules.insert(rules.end(), parsed.begin(), parsed.end());
+        return true;
+      }
+    }
+    else if (line.compare(0, 2, "- ") == 0) {
+      char* end;
+      auto index = std::strtoul(line.c_str() + 2, &end, 10);
+      if (*end == ' ') {
+        std::string text(end + 1);
+        auto matches = [&](const ConnectionRule& r)
+          { return fmt::format("{}", r) == text; };
+
+        if (index < rules.size() && matches(rules[index])) {
+          rules.erase(rules.begin() + index);
+          return true;
+        }
+        // The index should always be right, but the rule is what counts.
+        auto i = std::find_if(rules.rbegin(), rules.rend(), matches);
+        if (i != rules.rend()) {
+          rules.erase(std::next(i).base());
+          return true;
+        }
+        Msg::error("Journal {} removes a rule that isn't there: {}", path, text);
+        return false;
+      }
+    }
+
+    Msg::error("Journal {} has a bad entry, ignoring: {}", path, line);
+    return false;
+  }
+}
+
+
+RuleJournal::~RuleJournal() {
+  if (fd >= 0) {
+    flush();
+    close(fd);
+  }
+}
+
+std::size_t RuleJournal::open(const std::string& journalPath,
+  const std::string& snapshot, ConnectionRules& rules)
+{
+  path = journalPath;
+
+  std::string text;
+  if (Files::fileExists(path))
+    text = Files::readFile(path);
+
+  auto eol = text.find('\n');
+  bool current = eol != std::string::npos
+    && text.compare(0, eol, header(snapshot)) == 0;
+  if (!current && !text.empty())
+    Msg::detail("Journal {} predates the rules file, ignoring", path);
+
+  std::size_t applied = 0;
+  if (current) {
+    for (auto at = eol + 1; at < text.size(); ) {
+      eol = text.find('\n', at);
+      if (eol == std::string::npos) {
+        // the daemon stopped part way through writing it
+        Msg::error("Journal {} ends with an incomplete entry, ignoring it", path);
+        damaged = true;
+        break;
+      }
+      if (replay(path, text.substr(at, eol - at), rules))
+        applied += 1;
+      at = eol + 1;
+    }
+  }
+
+  fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw Msg::system_error("Could not open {}", path);
+
+  if (current) {
+    bytes = text.size();
+    count = applied;
+  }
+  else
+    restart(snapshot);
+  return applied;
+}
+
+void RuleJournal::added(const ConnectionRule& r) {
+  if (fd < 0) return;
+
+  fmt::format_to(std::back_inserter(held), "+ {}\n", r);
+  heldCount += 1;
+}
+
+void RuleJournal::removed(std::size_t index, const ConnectionRule& r) {
+  if (fd < 0) return;
+
+  fmt::format_to(std::back_inserter(held), "- {} {}\n", index, r);
+  heldCount += 1;
+}
+
+void RuleJournal::flush() {
+  if (fd < 0 || held.empty()) return;
+
+  append(held.data(), held.size());
+  count += heldCount;
+  held.clear();
+  heldCount = 0;
+}
+
+void RuleJournal::restart(const std::string& snapshot) {
+  if (fd < 0) return;
+
+  // If this is interrupted, what is left won't match the new rules file,
+  // and so will be ignored, as it should be.
+  if (ftruncate(fd, 0) != 0) {
+    Msg::error("Could not truncate {}: {}", path, std::strerror(errno));
+    damaged = true;
+    return;
+  }
+  bytes = 0;
+  count = 0;
+  damaged = false;
+  held.clear();
+  heldCount = 0;
+
+  auto line = header(snapshot) + '\n';
+  append(line.data(), line.size());
+}
+
+void RuleJournal::append(const char* data, std::size_t length) {
+  while (length > 0) {
+    auto n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      Msg::error("Could not write {}: {}", path, std::strerror(errno));
+      damaged = true;   // so the rules file is written whole instead
+      return;
+    }
+    data += n;
+    length -= n;
+    bytes += n;
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "rule.h"
+
+
+// The changes made to a set of rules since its rules file was last written
+// out whole, as an append-only text file next to it. Each change is one
+// line: a rule added at the end, or the rule at an index removed.
+//
+//     # midiminder rules journal, for 1234 bytes, hash 0123456789abcdef
+//     + Launchpad X --> Digitone
+//     - 3 Launchpad X -x-> Digitakt
+//
+// The first line identifies the rules file the changes apply to, so that
+// changes already written into it (should the daemon stop between writing
+// the rules file and starting a new journal) are not applied twice.
+//
+// Recording a change is one small write, where rewriting the rules file
+// would be a write of every rule, and a rename. Changes are held in memory
+// until flush(), so that a burst of them can go in one write. Once the
+// journal grows past compactAt, the owner should write the rules file out
+// whole, and call restart().
+//
+// Anything still held is flushed when the journal is destroyed.
+
+class RuleJournal {
+  public:
+    RuleJournal() { }
+    ~RuleJournal();
+
+    // Opens the journal at path, for the rules file whose contents are
+    // snapshot, and which parsed to rules. The changes recorded since then
+    // are applied to rules. Returns how many there were.
+    std::size_t open(const std::string& path,
+      const std::string& snapshot, ConnectionRules& rules);
+    bool isOpen() const { return fd >= 0; }
+
+    // Recording does nothing until the journal is opened.
+    void added(const ConnectionRule&);
+    void removed(std::size_t index, const ConnectionRule&);
+    void flush();
+
+    // Empties the journal, for a rules file just written as snapshot,
+    // which includes the changes not yet flushed.
+    void restart(const std::string& snapshot);
+
+    static constexpr std::size_t compactAt = 16 * 1024;
+    bool wantsCompaction() const
+      { return damaged || bytes + held.size() > compactAt; }
+
+    std::size_t size() const      { return bytes; }
+    std::size_t entries() const   { return count; }
+    std::size_t unflushed() const { return heldCount; }
+
+  private:
+    std::string path;
+    int fd = -1;
+    std::size_t bytes = 0;
+    std::size_t count = 0;
+    bool damaged = false;   // the file can't be trusted to take more entries
+
+    std::string held;       // entries not yet flushed
+    std::size_t heldCount = 0;
+
+    void append(const char* data, std::size_t length);
+
+    RuleJournal(const RuleJournal&) = delete;
+    RuleJournal& operator=(const RuleJournal&) = delete;
+};
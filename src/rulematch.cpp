@@ -0,0 +1,235 @@
+#include "rulematch.h"
+
+#include <algorithm>
+
+
+void RuleBits::reset(std::size_t n) {
+  count = (n + 63) / 64;
+  if (count <= inlineWords)
+    small.fill(0);
+  else
+    large.assign(count, 0);
+}
+
+bool RuleBits::any() const {
+  auto d = data();
+  for (std::size_t w = 0; w < count; ++w)
+    if (d[w]) return true;
+  return false;
+}
+
+bool RuleBits::lastInBoth(
+    const RuleBits& a, const RuleBits& b, std::size_t& index)
+{
+  auto ad = a.data();
+  auto bd = b.data();
+  for (auto w = std::min(a.count, b.count); w > 0; --w) {
+    uint64_t both = ad[w - 1] & bd[w - 1];
+    if (both) {
+      index = (w - 1) * 64 + 63 - __builtin_clzll(both);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+const std::vector<std::size_t> RuleIndex::none;
+
+RuleIndex::RuleIndex(const ConnectionRules& rules) {
+  senders.partialPort.resize(rules.size(), -1);
+  dests.partialPort.resize(rules.size(), -1);
+
+  for (std::size_t i = 0; i < rules.size(); ++i) {
+    senders.add(rules[i].senderSpec(), i, *this);
+    dests.add(rules[i].destSpec(), i, *this);
+  }
+
+  clientNames.build();
+  portNames.build();
+}
+
+void RuleIndex::Buckets::add(
+  const AddressSpec& a, std::size_t i, RuleIndex& index)
+{
+  auto& c = a.clientSpec();
+  if (c.isExact())
+    exact[c.name()].push_back(i);
+  else {
+    other.push_back(i);
+
+    if (c.isPartial()) {
+      auto id = index.clientNames.add(c.name());
+      if (id >= byPartialClient.size())
+        byPartialClient.resize(id + 1);
+      byPartialClient[id].push_back(i);
+    }
+    else
+      general.push_back(i);
+  }
+
+  auto& p = a.portSpec();
+  if (p.isPartial())
+    partialPort[i] = index.portNames.add(p.name());
+}
+
+RuleIndex::Cursor
+RuleIndex::Buckets::candidates(const std::string& client) const {
+  auto e = exact.find(client);
+  return Cursor(e == exact.end() ? none : e->second, other);
+}
+
+RuleIndex::Cursor RuleIndex::senderCandidates(const Address& a) const
+  { return senders.candidates(a.client); }
+
+RuleIndex::Cursor RuleIndex::destCandidates(const Address& a) const
+  { return dests.candidates(a.client); }
+
+
+RuleIndex::Cursor::Cursor(
+    const std::vector<std::size_t>& x, const std::vector<std::size_t>& y)
+  : a(x.rbegin()), aEnd(x.rend()), b(y.rbegin()), bEnd(y.rend())
+  { }
+
+std::size_t RuleIndex::Cursor::index() const {
+  // the two buckets never share a rule, so there are no ties
+  if (a == aEnd)  return *b;
+  if (b == bEnd)  return *a;
+  return *a > *b ? *a : *b;
+}
+
+void RuleIndex::Cursor::next() {
+  if (a == aEnd)        ++b;
+  else if (b == bEnd)   ++a;
+  else if (*a > *b)     ++a;
+  else                  ++b;
+}
+
+
+void RuleIndex::match(
+  const ConnectionRules& rules, const Address& a, RuleMatches& m) const
+{
+  if (!a.canBeSender() && !a.canBeDest())
+    return;
+
+  ScratchVector<bool> clientFound(clientNames.size());
+  ScratchVector<bool> portFound(portNames.size());
+  clientNames.scan(a.client, clientFound);
+  portNames.scan(a.port, portFound);
+
+  if (a.canBeSender())
+    senders.match(rules, a, true, clientFound, portFound, m.asSender);
+  if (a.canBeDest())
+    dests.match(rules, a, false, clientFound, portFound, m.asDest);
+}
+
+void RuleIndex::Buckets::match(
+  const ConnectionRules& rules, const Address& a, bool asSender,
+  const ScratchVector<bool>& clientFound, const ScratchVector<bool>& portFound,
+  RuleBits& bits) const
+{
+  // Called only for rules whose client spec is known to match, other than
+  // for the general rules. Partial port specs are resolved from the port
+  // name scan, all other kinds of port spec are cheap to test directly.
+
+  auto check = [&](std::size_t i) {
+    auto& spec = asSender ? rules[i].senderSpec() : rules[i].destSpec();
+    auto& p = spec.portSpec();
+    int pp = partialPort[i];
+    bool portMatch =
+      pp >= 0
+        ? portFound[pp] || a.portLong == p.name()
+        : (asSender ? p.matchAsSender(a) : p.matchAsDest(a));
+    if (portMatch)
+      bits.set(i);
+  };
+
+  auto e = exact.find(a.client);
+  if (e != exact.end())
+    for (auto i : e->second)
+      check(i);
+
+  for (std::size_t id = 0; id < byPartialClient.size(); ++id)
+    if (clientFound[id])
+      for (auto i : byPartialClient[id])
+        check(i);
+
+  for (auto i : general) {
+    auto& spec = asSender ? rules[i].senderSpec() : rules[i].destSpec();
+    if (spec.clientSpec().match(a))
+      check(i);
+  }
+}
+
+
+RuleMatches::RuleMatches(
+    const ConnectionRules& rules, const RuleIndex& index, const Address& a)
+{
+  update(rules, index, a);
+}
+
+void RuleMatches::update(
+    const ConnectionRules& rules, const RuleIndex& index, const Address& a)
+{
+  asSender.reset(rules.size());
+  asDest.reset(rules.size());
+  index.match(rules, a, *this);
+}
+
+
+FoundRule findRule(const ConnectionRules& rules, const RuleIndex& index,
+  const Address& sender, const Address& dest)
+{
+  // A rule can only match if it is a candidate for both the sender and
+  // the dest. Both cursors run in precedence order, so the first rule
+  // found in both that matches is the one that applies.
+
+  auto s = index.senderCandidates(sender);
+  auto d = index.destCandidates(dest);
+  while (!s.done() && !d.done()) {
+    auto si = s.index();
+    auto di = d.index();
+    if (si > di)      { s.next(); continue; }
+    if (di > si)      { d.next(); continue; }
+
+    auto& r = rules[si];
+    if (r.match(sender, dest))
+      return {r.isBlockingRule() ? Found::DisallowRule : Found::ConnectRule, si};
+    s.next();
+    d.next();
+  }
+  return {Found::NoRule, rules.size()};
+}
+
+
+DecisionCache::Entry& DecisionCache::slot(const snd_seq_connect_t& conn) {
+  // Fibonacci hashing, as in ConnectionSet
+  return entries[(packConnect(conn) * 0x9e3779b1u) >> (32 - slotBits)];
+}
+
+const DecisionCache::Decision*
+DecisionCache::find(const snd_seq_connect_t& conn, unsigned int generation) {
+  auto& e = slot(conn);
+  if (!e.used || e.generation != generation || !(e.conn == conn)) {
+    misses += 1;
+    return nullptr;
+  }
+  hits += 1;
+  return &e.decision;
+}
+
+void DecisionCache::insert(const snd_seq_connect_t& conn,
+  unsigned int generation, const Decision& decision)
+{
+  auto& e = slot(conn);
+  e.used = true;
+  e.conn = conn;
+  e.generation = generation;
+  e.decision = decision;
+}
+
+void DecisionCache::forgetPort(const snd_seq_addr_t& addr) {
+  for (auto& e : entries)
+    if (e.used && (e.conn.sender == addr || e.conn.dest == addr))
+      e.used = false;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "addrtables.h"
+#include "rule.h"
+#include "seq.h"
+#include "substring.h"
+
+
+// A set of rules, as one bit per rule index into a ConnectionRules. The
+// bits for up to inlineRules rules are held in the RuleBits itself, so only
+// larger rule sets allocate.
+
+class RuleBits {
+  public:
+    RuleBits() { }
+    explicit RuleBits(std::size_t n) { reset(n); }
+
+    // empties the set, and sizes it for n rules, reusing its storage
+    void reset(std::size_t n);
+
+    void set(std::size_t i)         { data()[i / 64] |= bit(i); }
+    bool test(std::size_t i) const
+      { return i / 64 < count && (data()[i / 64] & bit(i)); }
+
+    bool any() const;
+
+    // Finds the last rule in both sets, which is the one that takes
+    // precedence for a pair of ports. Returns false if there is none.
+    static bool lastInBoth(const RuleBits&, const RuleBits&, std::size_t&);
+
+    static constexpr std::size_t inlineRules = 256;
+
+  private:
+    static uint64_t bit(std::size_t i) { return uint64_t(1) << (i % 64); }
+
+    static constexpr std::size_t inlineWords = inlineRules / 64;
+
+    uint64_t* data()
+      { return count <= inlineWords ? small.data() : large.data(); }
+    const uint64_t* data() const
+      { return count <= inlineWords ? small.data() : large.data(); }
+
+    std::size_t count = 0;    // of words in use
+    std::array<uint64_t, inlineWords> small = {};
+    std::vector<uint64_t> large;
+};
+
+
+struct RuleMatches;
+
+
+// An index of a ConnectionRules by the client specs of each rule's sender
+// and dest. Rules with an exact client name are bucketed by that name. All
+// other rules (partial, numeric, type and wildcard specs) go in a single
+// bucket that is always consulted. Only the buckets that could possibly
+// match a port are examined, so exact rules (which is nearly all of the
+// observed rules) cost nothing for ports of other clients.
+//
+// When computing which rules a port matches, the partial client and port
+// names of all the rules are found with one pass each over the port's
+// client and port names, rather than a substring search per rule.
+//
+// The index holds rule positions, and so must be rebuilt whenever the
+// rules it was built from change.
+
+class RuleIndex {
+  public:
+    RuleIndex() { }
+    explicit RuleIndex(const ConnectionRules&);
+
+    // Walks the positions of candidate rules, from last to first, which is
+    // the order of precedence.
+    class Cursor {
+      public:
+        bool done() const   { return a == aEnd && b == bEnd; }
+        std::size_t index() const;
+        void next();
+
+      private:
+        using Iter = std::vector<std::size_t>::const_reverse_iterator;
+        Iter a, aEnd, b, bEnd;
+
+        Cursor(const std::vector<std::size_t>&, const std::vector<std::size_t>&);
+        friend class RuleIndex;
+    };
+
+    Cursor senderCandidates(const Address&) const;
+    Cursor destCandidates(const Address&) const;
+
+    void match(const ConnectionRules&, const Address&, RuleMatches&) const;
+
+  private:
+    struct Buckets {
+      std::unordered_map<std::string, std::vector<std::size_t>> exact;
+      std::vector<std::size_t> other;
+
+      std::vector<std::vector<std::size_t>> byPartialClient;
+        // by id in clientNames
+      std::vector<std::size_t> general;
+        // rules with numeric or wildcard client specs
+      std::vector<int> partialPort;
+        // for each rule, id in portNames, or -1 if not a partial port spec
+
+      void add(const AddressSpec&, std::size_t, RuleIndex&);
+      Cursor candidates(const std::string& client) const;
+      void match(const ConnectionRules&, const Address&, bool asSender,
+        const ScratchVector<bool>& clientFound,
+        const ScratchVector<bool>& portFound, RuleBits&) const;
+    };
+
+    Buckets senders;
+    Buckets dests;
+
+    SubstringMatcher clientNames;
+    SubstringMatcher portNames;
+
+    static const std::vector<std::size_t> none;
+};
+
+
+// The rules of a ConnectionRules that a port matches, as sender and as dest.
+// These are computed once when a port becomes known, and then only
+// recomputed when the rules change.
+
+struct RuleMatches {
+  RuleBits asSender;
+  RuleBits asDest;
+
+  RuleMatches() { }
+  RuleMatches(const ConnectionRules&, const RuleIndex&, const Address&);
+
+  // recomputes the matches in place, reusing the storage of the bits
+  void update(const ConnectionRules&, const RuleIndex&, const Address&);
+};
+
+
+// The rule that applies to a (sender, dest) pair, if any.
+
+enum class Found {
+  NoRule,
+  ConnectRule,
+  DisallowRule,
+};
+
+struct FoundRule {
+  Found found;
+  std::size_t position;   // of the rule, or the number of rules if none
+};
+
+FoundRule findRule(const ConnectionRules&, const RuleIndex&,
+  const Address& sender, const Address& dest);
+
+
+// Remembers the findRule results, for both profile and observed rules, of
+// (sender, dest) pairs that have been looked up. Results are tagged with the
+// generation of the rules they were found in, and a result from any other
+// generation is a miss.
+//
+// The cache is a fixed number of slots, each pair having just the one it
+// hashes to, so that it never grows, and a later pair simply takes the slot
+// of an earlier one.
+
+class DecisionCache {
+  public:
+    struct Decision {
+      FoundRule observed;
+      FoundRule profile;
+    };
+
+    // returns nullptr if there is no current result for the pair
+    const Decision* find(const snd_seq_connect_t&, unsigned int generation);
+    void insert(const snd_seq_connect_t&, unsigned int generation,
+      const Decision&);
+
+    // drop results for a port, as it may now have a different name
+    void forgetPort(const snd_seq_addr_t&);
+
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+
+  private:
+    static constexpr int slotBits = 8;
+
+    struct Entry {
+      bool used = false;
+      snd_seq_connect_t conn;
+      unsigned int generation;
+      Decision decision;
+    };
+
+    std::array<Entry, 1 << slotBits> entries;
+
+    Entry& slot(const snd_seq_connect_t&);
+};
@@ -1,5 +1,6 @@
 #include "seq.h"
 
+#include <cstring>
 #include <sstream>
 #include <string_view>
 #include <vector>
@@ -11,13 +12,14 @@ const Address Address::null;
 
 Address::Address(
     const snd_seq_addr_t& a, bool m, unsigned int f, unsigned int t,
-    const std::string& c, const std::string& p)
+    const Name& c, const Name& p)
   : valid(true), mindable(m), addr(a), caps(f), types(t),
     client(c), port(p), portLong(p),
     primarySender(false), primaryDest(false)
 {
   static const std::string whitespace = " _";
-  std::string_view trimmed(portLong);
+  const std::string& clientStr = c.str();
+  std::string_view trimmed(p.str());
 
   while (true) {
     if (trimmed.size() > 0
@@ -25,10 +27,10 @@ Address::Address(
       trimmed.remove_prefix(1);
       continue;
     }
-    if (trimmed.size() > client.size()
+    if (trimmed.size() > clientStr.size()
                           // not >= as we want there to be something left
-        && trimmed.substr(0, client.size()) == client) {
-      trimmed.remove_prefix(client.size());
+        && trimmed.substr(0, clientStr.size()) == clientStr) {
+      trimmed.remove_prefix(clientStr.size());
       continue;
     }
     break;
@@ -42,8 +44,8 @@ Address::Address(
     break;
   }
 
-  if (trimmed.size() > 0)
-    port = trimmed;
+  if (trimmed.size() > 0 && trimmed.size() < p.size())
+    port = Name(trimmed);
 }
 
 
@@ -62,6 +64,16 @@ void Seq::begin(const char* clientName) {
   serr = snd_seq_set_client_name(seq, clientName);
   if (errFatal(serr, "name sequencer")) return;
 
+  // Only the announcements are of interest.
+  for (int type : {
+      SND_SEQ_EVENT_CLIENT_START, SND_SEQ_EVENT_CLIENT_EXIT,
+      SND_SEQ_EVENT_CLIENT_CHANGE, SND_SEQ_EVENT_PORT_START,
+      SND_SEQ_EVENT_PORT_EXIT, SND_SEQ_EVENT_PORT_CHANGE,
+      SND_SEQ_EVENT_PORT_SUBSCRIBED, SND_SEQ_EVENT_PORT_UNSUBSCRIBED }) {
+    serr = snd_seq_set_client_event_filter(seq, type);
+    if (errCheck(serr, "set event filter")) break;
+  }
+
   evtPort = snd_seq_create_simple_port(seq, "panopticon",
     SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
     SND_SEQ_PORT_TYPE_APPLICATION);
@@ -73,6 +85,25 @@ void Seq::begin(const char* clientName) {
 
 }
 
+void Seq::setInputSize(std::size_t events) {
+  int serr;
+
+  // The kernel's queue for this client, and alsa-lib's buffer that it is
+  // read into.
+  serr = snd_seq_set_client_pool_input(seq, events);
+  if (errCheck(serr, "set input pool")) return;
+  serr = snd_seq_set_input_buffer_size(seq, events * sizeof(snd_seq_event_t));
+  if (errCheck(serr, "set input buffer size")) return;
+}
+
+void Seq::stopAnnouncements() {
+  int serr = snd_seq_disconnect_from(seq, evtPort,
+    SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE);
+  if (errCheck(serr, "disconnect from system announce port")) return;
+
+  snd_seq_drop_input(seq);
+}
+
 void Seq::end() {
   if (seq) {
     auto seq_ = seq;
@@ -83,6 +114,7 @@ void Seq::end() {
 
 
 std::string Seq::clientName(client_id_t c) {
+  // Always asks the kernel, as this is how a rename is noticed.
   int serr;
 
   snd_seq_client_info_t *client;
@@ -91,13 +123,21 @@ std::string Seq::clientName(client_id_t c) {
   if (serr == -ENOENT) return {}; // client has already exited!
   if (errCheck(serr, "get client info")) return "";
 
-  return snd_seq_client_info_get_name(client);
+  std::string name = snd_seq_client_info_get_name(client);
+  if (cache[c].name != name)
+    cache[c].forget();
+  return name;
 }
 
 
 Address Seq::address(const snd_seq_addr_t& addr) {
   int serr;
 
+  if (auto cached = cache[addr.client].find(addr.port)) {
+    queriesSaved += 2;
+    return *cached;
+  }
+
   snd_seq_client_info_t *client;
   snd_seq_client_info_alloca(&client);
   serr = snd_seq_get_any_client_info(seq, addr.client, client);
@@ -109,6 +149,19 @@ Address Seq::address(const snd_seq_addr_t& addr) {
   serr = snd_seq_get_any_port_info(seq, addr.client, addr.port, port);
   if (errCheck(serr, "get port info")) return {};
 
+  auto a = makeAddress(addr, client, port);
+  auto& cc = cache[addr.client];
+  if (cc.name != a.client) {
+    cc.forget();
+    cc.name = a.client;
+  }
+  cc.ports.push_back(a);
+  return a;
+}
+
+Address Seq::makeAddress(const snd_seq_addr_t& addr,
+  snd_seq_client_info_t* client, snd_seq_port_info_t* port) const
+{
   auto caps = snd_seq_port_info_get_capability(port);
 
   auto types = snd_seq_port_info_get_type(port);
@@ -124,6 +177,69 @@ Address Seq::address(const snd_seq_addr_t& addr) {
             snd_seq_port_info_get_name(port));
 }
 
+void Seq::cacheScannedPort(
+  snd_seq_client_info_t* client, snd_seq_port_info_t* port)
+{
+  auto& addr = *snd_seq_port_info_get_addr(port);
+  auto& cc = cache[addr.client];
+  cc.name = snd_seq_client_info_get_name(client);
+  cc.forgetPort(addr.port);
+  cc.ports.push_back(makeAddress(addr, client, port));
+}
+
+void Seq::forgetClient(client_id_t c) {
+  cache[c].forget();
+}
+
+Address* Seq::CachedClient::find(unsigned char port) {
+  for (auto& a : ports)
+    if (a.addr.port == port)
+      return &a;
+  return nullptr;
+}
+
+void Seq::CachedClient::forgetPort(unsigned char port) {
+  if (auto a = find(port)) {
+    std::swap(*a, ports.back());
+    ports.pop_back();
+  }
+}
+
+void Seq::CachedClient::forget() {
+  name = Name();
+  ports.clear();
+}
+
+void Seq::forgetAll() {
+  for (auto& cc : cache)
+    cc.forget();
+}
+
+void Seq::forget(const snd_seq_event_t& ev) {
+  switch (ev.type) {
+    case SND_SEQ_EVENT_CLIENT_START:
+    case SND_SEQ_EVENT_CLIENT_EXIT:
+    case SND_SEQ_EVENT_CLIENT_CHANGE:
+    case SND_SEQ_EVENT_PORT_START:
+      forgetClient(ev.data.addr.client);
+      break;
+
+    case SND_SEQ_EVENT_PORT_EXIT:
+    case SND_SEQ_EVENT_PORT_CHANGE:
+      cache[ev.data.addr.client].forgetPort(ev.data.addr.port);
+      break;
+
+    default:
+      break;
+  }
+}
+
+bool Seq::takeOverrun() {
+  bool r = overrun;
+  overrun = false;
+  return r;
+}
+
 void Seq::scanFDs(std::function<void(int)> fn) {
   int npfd = snd_seq_poll_descriptors_count(seq, POLLIN);
   auto pfds = (struct pollfd *)alloca(npfd * sizeof(struct pollfd));
@@ -133,19 +249,30 @@ void Seq::scanFDs(std::function<void(int)> fn) {
 }
 
 snd_seq_event_t* Seq::eventInput() {
-  if (snd_seq_event_input_pending(seq, 1) == 0)
-    return nullptr;
-
-  snd_seq_event_t *ev;
-  auto q = snd_seq_event_input(seq, &ev);
-
-  if (q == -EAGAIN)
-    return nullptr;
+  while (snd_seq_event_input_pending(seq, 1) != 0) {
+    snd_seq_event_t *ev;
+    auto q = snd_seq_event_input(seq, &ev);
+
+    if (q == -EAGAIN)
+      return nullptr;
+
+    if (q == -ENOSPC) {
+      // The kernel's queue filled, and it threw away what was in it: those
+      // events are lost, and the caller must resync from the system (see
+      // takeOverrun). Whatever has arrived since can still be read.
+      Msg::error("ALSA Seq input overrun, events were lost");
+      overruns += 1;
+      overrun = true;
+      continue;
+    }
 
-  if (errCheck(q, "event input"))
-    return nullptr;
+    if (errCheck(q, "event input"))
+      return nullptr;
 
-  return ev;
+    forget(*ev);
+    return ev;
+  }
+  return nullptr;
 }
 
 void Seq::scanClients(std::function<void(client_id_t)> func) {
@@ -170,6 +297,7 @@ void Seq::scanPorts(std::function<void(const snd_seq_addr_t&)> func) {
   snd_seq_port_info_t *port;
   snd_seq_port_info_alloca(&port);
 
+  forgetAll();
   snd_seq_client_info_set_client(client, -1);
   while (snd_seq_query_next_client(seq, client) >= 0) {
     auto clientId = snd_seq_client_info_get_client(client);
@@ -184,6 +312,7 @@ void Seq::scanPorts(std::function<void(const snd_seq_addr_t&)> func) {
     snd_seq_port_info_set_client(port, clientId);
     snd_seq_port_info_set_port(port, -1);
     while (snd_seq_query_next_port(seq, port) >= 0) {
+      cacheScannedPort(client, port);
 
       snd_seq_addr_t addr = *snd_seq_port_info_get_addr(port);
       func(addr);
@@ -206,6 +335,7 @@ void Seq::scanConnections(std::function<void(const snd_seq_connect_t&)> func) {
   snd_seq_port_subscribe_alloca(&subs);
 
 
+  forgetAll();
   snd_seq_client_info_set_client(client, -1);
   while (snd_seq_query_next_client(seq, client) >= 0) {
 
@@ -214,6 +344,7 @@ void Seq::scanConnections(std::function<void(const snd_seq_connect_t&)> func) {
     snd_seq_port_info_set_client(port, clientId);
     snd_seq_port_info_set_port(port, -1);
     while (snd_seq_query_next_port(seq, port) >= 0) {
+      cacheScannedPort(client, port);
 
       auto p0 = snd_seq_port_info_get_addr(port);
 
@@ -233,11 +364,74 @@ void Seq::scanConnections(std::function<void(const snd_seq_connect_t&)> func) {
   }
 }
 
+namespace {
+  class Hasher {
+    // FNV-1a
+    public:
+      Seq::Fingerprint value = 0xcbf29ce484222325ull;
+
+      void add(const void* data, std::size_t n) {
+        auto p = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < n; ++i) {
+          value ^= p[i];
+          value *= 0x100000001b3ull;
+        }
+      }
+      void add(unsigned int v)  { add(&v, sizeof(v)); }
+      void add(const char* s)   { add(s, strlen(s) + 1); }
+  };
+}
+
+void Seq::scanFingerprints(std::function<void(client_id_t, Fingerprint,
+  const std::vector<PortFingerprint>&)> func)
+{
+  snd_seq_client_info_t *client;
+  snd_seq_client_info_alloca(&client);
+
+  snd_seq_port_info_t *port;
+  snd_seq_port_info_alloca(&port);
+
+  std::vector<PortFingerprint> ports;
+
+  snd_seq_client_info_set_client(client, -1);
+  while (snd_seq_query_next_client(seq, client) >= 0) {
+    auto clientId = snd_seq_client_info_get_client(client);
+
+    Hasher h;
+    h.add(snd_seq_client_info_get_name(client));
+    ports.clear();
+
+    snd_seq_port_info_set_client(port, clientId);
+    snd_seq_port_info_set_port(port, -1);
+    while (snd_seq_query_next_port(seq, port) >= 0) {
+      Hasher p;
+      p.add(snd_seq_port_info_get_name(port));
+      p.add(snd_seq_port_info_get_capability(port));
+      p.add(snd_seq_port_info_get_type(port));
+      ports.push_back({ *snd_seq_port_info_get_addr(port), p.value });
+    }
+
+    func(clientId, h.value, ports);
+  }
+}
+
 void Seq::connect(const snd_seq_addr_t& sender, const snd_seq_addr_t& dest) {
+  int serr = subscribe(seq, {sender, dest});
+  if (serr == -EBUSY) return;  // connection is already made
+  errCheck(serr, "subscribe");
+}
+
+void Seq::disconnect(const snd_seq_connect_t& conn) {
+  int serr = unsubscribe(seq, conn);
+  if (serr == -ENOENT) return;  // connection not found
+  errCheck(serr, "unsubscribe");
+}
+
+int Seq::subscribe(snd_seq_t* handle, const snd_seq_connect_t& conn) {
   snd_seq_port_subscribe_t *subs;
   snd_seq_port_subscribe_alloca(&subs);
-  snd_seq_port_subscribe_set_sender(subs, &sender);
-  snd_seq_port_subscribe_set_dest(subs, &dest);
+  snd_seq_port_subscribe_set_sender(subs, &conn.sender);
+  snd_seq_port_subscribe_set_dest(subs, &conn.dest);
 
   // FIXME: these should be saved with the Connection & restored
   snd_seq_port_subscribe_set_queue(subs, 0);
@@ -245,22 +439,16 @@ void Seq::connect(const snd_seq_addr_t& sender, const snd_seq_addr_t& dest) {
   snd_seq_port_subscribe_set_time_update(subs, 0);
   snd_seq_port_subscribe_set_time_real(subs, 0);
 
-  int serr;
-  serr = snd_seq_subscribe_port(seq, subs);
-  if (serr == -EBUSY) return;  // connection is already made
-  errCheck(serr, "subscribe");
+  return snd_seq_subscribe_port(handle, subs);
 }
 
-void Seq::disconnect(const snd_seq_connect_t& conn) {
+int Seq::unsubscribe(snd_seq_t* handle, const snd_seq_connect_t& conn) {
   snd_seq_port_subscribe_t *subs;
   snd_seq_port_subscribe_alloca(&subs);
   snd_seq_port_subscribe_set_sender(subs, &conn.sender);
   snd_seq_port_subscribe_set_dest(subs, &conn.dest);
 
-  int serr;
-  serr = snd_seq_unsubscribe_port(seq, subs);
-  if (serr == -ENOENT) return;  // connection not found
-  errCheck(serr, "unsubscribe");
+  return snd_seq_unsubscribe_port(handle, subs);
 }
 
 
@@ -3,21 +3,30 @@
 // Manage being an ALSA Sequencer client
 
 #include <alsa/asoundlib.h>
+#include <array>
+#include <cstdint>
 #include <fmt/format.h>
 #include <functional>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "names.h"
 
 class Address {
   public:
     Address()
-      : valid(false), addr{0, 0}
+      : valid(false), mindable(false), addr{0, 0}
       { }
     Address(const snd_seq_addr_t& a, bool m, unsigned int f, unsigned int t,
-        const std::string& c, const std::string& p);
-
-    // allow copying
+        const Name& c, const Name& p);
+
+    // Allow copying; it is cheap, as the names are shared: A copy takes a
+    // reference to each of the three, and never allocates or locks the name
+    // table, which is only consulted when an Address is made from what the
+    // kernel reports. An Address is a value, not a handle to one descriptor
+    // shared by all holders of a port, because each holder works out its
+    // own primarySender and primaryDest.
     Address(const Address&) = default;
     Address& operator=(const Address&) = default;
 
@@ -40,9 +49,9 @@ class Address {
     snd_seq_addr_t addr;
     unsigned int caps;
     unsigned int types;
-    std::string client;
-    std::string port;
-    std::string portLong;
+    Name client;
+    Name port;
+    Name portLong;
     bool primarySender;
     bool primaryDest;
 };
@@ -54,6 +63,7 @@ class Seq {
     Seq() { }
 
     void begin(const char* clientName);
+    void setInputSize(std::size_t events);  // how many can be waiting
     void end();
     operator bool() const { return seq; }
 
@@ -63,13 +73,40 @@ class Seq {
     void scanFDs(std::function<void(int)>);
     snd_seq_event_t * eventInput();
       // if nullptr is returned, sleep and call again...
+      // Events read here also keep the address cache up to date.
+
+    // If the kernel had to drop events because the input was full, then
+    // what's known of the system may be wrong. Returns true once for each
+    // time that happened since the last call.
+    bool takeOverrun();
 
     void scanClients(std::function<void(client_id_t)>);
     void scanPorts(std::function<void(const snd_seq_addr_t&)>);
     void scanConnections(std::function<void(const snd_seq_connect_t&)>);
+
+    // Calls func for each client, with a hash of its name, and for each of
+    // its ports, in order, a hash of the port's name, capabilities and types.
+    using Fingerprint = std::uint64_t;
+    struct PortFingerprint {
+      snd_seq_addr_t addr;
+      Fingerprint fingerprint;
+    };
+    void scanFingerprints(std::function<void(client_id_t, Fingerprint,
+      const std::vector<PortFingerprint>&)>);
+
+    void forgetClient(client_id_t);   // drops it from the address cache
+    void forget(const snd_seq_event_t&);
+      // drops what the event makes stale; for events read by another Seq
+
+    void stopAnnouncements();
+      // for when another Seq is reading them, drops any already received
     void connect(const snd_seq_addr_t& sender, const snd_seq_addr_t& dest);
     void disconnect(const snd_seq_connect_t& conn);
 
+    // The bare operations, on any sequencer handle. Return the ALSA error.
+    static int subscribe(snd_seq_t*, const snd_seq_connect_t&);
+    static int unsubscribe(snd_seq_t*, const snd_seq_connect_t&);
+
     bool errCheck(int serr, const char* op);
     bool errFatal(int serr, const char* op);
 
@@ -78,6 +115,35 @@ class Seq {
     client_id_t seqClient;
     int evtPort;
 
+    // Addresses already fetched from the kernel, by client. A full scan
+    // refreshes it, and announce events passing through eventInput() drop
+    // the clients and ports they concern. A new port drops its whole
+    // client, as the kernel doesn't announce when a client is renamed.
+    //
+    // A client has few ports, so they are kept unordered and searched.
+    // Dropping a client keeps the space its ports took, ready for when it,
+    // or another client with the same id, is next added.
+    struct CachedClient {
+      Name name;
+      std::vector<Address> ports;
+
+      Address* find(unsigned char port);
+      void forgetPort(unsigned char port);
+      void forget();
+    };
+    std::array<CachedClient, 256> cache;    // by client id
+    void forgetAll();
+
+    Address makeAddress(const snd_seq_addr_t&,
+      snd_seq_client_info_t*, snd_seq_port_info_t*) const;
+    void cacheScannedPort(snd_seq_client_info_t*, snd_seq_port_info_t*);
+
+    bool overrun = false;
+
+  public:
+    unsigned long queriesSaved = 0;   // kernel queries answered from cache
+    unsigned long overruns = 0;       // times events were dropped
+
   public:
     static void outputAddr(std::ostream&, const snd_seq_addr_t&);
     static void outputConnect(std::ostream&, const snd_seq_connect_t&);
@@ -0,0 +1,136 @@
+#include "seqreader.h"
+
+#include <csignal>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+#include "msg.h"
+
+
+namespace {
+  void signalFD(int fd) {
+    uint64_t one = 1;
+    auto n = write(fd, &one, sizeof(one));
+    (void)n;    // can only fail if the count would overflow
+  }
+
+  void clearFD(int fd) {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) > 0)
+      ;
+  }
+}
+
+
+SeqReader::SeqReader() {
+  wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  stopFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFD < 0 || stopFD < 0)
+    throw Msg::system_error("eventfd failed");
+}
+
+SeqReader::~SeqReader() {
+  end();
+  close(wakeFD);
+  close(stopFD);
+}
+
+bool SeqReader::begin(std::size_t inputSize) {
+  seq.begin("midiminder reader");
+  if (!seq)
+    return false;
+  seq.setInputSize(inputSize);
+
+  // Signals must go to the main thread, to interrupt its epoll_wait().
+  // The new thread inherits this mask.
+  sigset_t all, prior;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &prior);
+
+  try {
+    thread = std::thread(&SeqReader::work, this);
+    pthread_sigmask(SIG_SETMASK, &prior, nullptr);
+  }
+  catch (const std::system_error& e) {
+    pthread_sigmask(SIG_SETMASK, &prior, nullptr);
+    // Most likely, the process limit: The shipped systemd unit has
+    // LimitNPROC=1.
+    Msg::error("Couldn't start reader thread: {}", e.what());
+    seq.end();
+    return false;
+  }
+
+  Msg::detail("Reading ALSA Seq events on a separate thread");
+  return true;
+}
+
+void SeqReader::end() {
+  if (!running())
+    return;
+
+  signalFD(stopFD);
+  thread.join();
+  clearFD(stopFD);
+  seq.end();
+}
+
+bool SeqReader::next(snd_seq_event_t& ev, Latency::Stamp& received) {
+  Record r;
+  if (!ring.pop(r)) {
+    // Anything pushed after clearing will signal the fd again.
+    clearFD(wakeFD);
+    if (!ring.pop(r))
+      return false;
+  }
+
+  ev = {};
+  ev.type = r.type;
+  ev.data.connect = r.data;
+  received = r.received;
+  this->received += 1;
+  return true;
+}
+
+unsigned long SeqReader::takeDropped() {
+  auto n = lost.exchange(0);
+  dropped += n;
+  return n;
+}
+
+bool SeqReader::takeOverrun() {
+  auto n = overran.exchange(0);
+  overruns += n;
+  return n > 0;
+}
+
+void SeqReader::work() {
+  std::vector<pollfd> fds;
+  seq.scanFDs([&](int fd){ fds.push_back({fd, POLLIN, 0}); });
+  fds.push_back({stopFD, POLLIN, 0});
+
+  while (true) {
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      Msg::error("Reader thread poll failed: {}", errno);
+      return;
+    }
+    if (fds.back().revents)
+      return;
+
+    bool any = false;
+    while (snd_seq_event_t* ev = seq.eventInput()) {
+      if (!ring.push({ev->type, ev->data.connect, Latency::Clock::now()}))
+        lost += 1;
+      any = true;
+    }
+    if (seq.takeOverrun()) {
+      overran += 1;
+      any = true;
+    }
+    if (any)
+      signalFD(wakeFD);
+  }
+}
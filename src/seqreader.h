@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "latency.h"
+#include "seq.h"
+#include "spscring.h"
+
+
+// Reads ALSA Seq announce events on a thread of its own.
+//
+// The daemon's main loop also serves user commands, which can take a
+// while, and meanwhile the sequencer's small input buffer can fill up.
+// This thread does nothing but drain the events, through a sequencer
+// client of its own, into a ring of compact records. The main loop takes
+// them from there, woken by an eventfd.
+//
+// If the ring fills, events are counted and dropped; the main loop should
+// then resync with the system.
+
+class SeqReader {
+  public:
+    SeqReader();
+    ~SeqReader();
+
+    bool begin(std::size_t inputSize);
+      // returns false if the thread couldn't be started
+    void end();
+    bool running() const { return thread.joinable(); }
+
+    int fd() const { return wakeFD; }
+
+    // Call when fd() is readable, until it returns false. Also returns
+    // when the event was read.
+    bool next(snd_seq_event_t&, Latency::Stamp&);
+
+    // Returns the number of events lost since the last call, because the
+    // ring was full, or the kernel dropped them.
+    unsigned long takeDropped();
+    bool takeOverrun();
+
+    unsigned long received = 0;
+    unsigned long dropped = 0;
+    unsigned long overruns = 0;
+
+  private:
+    struct Record {
+      unsigned char type;
+      snd_seq_connect_t data;   // data.addr is data.connect.sender
+      Latency::Stamp received;
+    };
+
+    Seq seq;
+    std::thread thread;
+    SpscRing<Record, 1024> ring;
+    std::atomic<unsigned long> lost{0};
+    std::atomic<unsigned long> overran{0};
+    int wakeFD;
+    int stopFD;
+
+    void work();
+
+    SeqReader(const SeqReader&) = delete;
+    SeqReader& operator=(const SeqReader&) = delete;
+};
@@ -47,6 +47,7 @@ void SeqSnapshot::refresh() {
   clients.clear();
   ports.clear();
   connections.clear();
+  connectionIndex.clear();
 
   seq.scanClients([&](client_id_t c) {
     if (includeAllItems || seq.isMindableClient(c)) {
@@ -58,24 +59,20 @@ void SeqSnapshot::refresh() {
   std::sort(clients.begin(), clients.end(),
     numericSort ? numericClientLess : lexicalClientLess);
 
+  struct PrimariesFound { bool sender = false; bool dest = false; };
+  std::map<client_id_t, PrimariesFound> primariesFound;
   seq.scanPorts([&](const snd_seq_addr_t& a) {
     auto address = seq.address(a);
     if (includeAllItems || address.mindable) {
-      // Compute primary port status. See comment in service.cpp for
-      // details and caveats about this computation.
-
-      bool foundPrimarySender = false;
-      bool foundPrimaryDest = false;
-      for (auto& p : ports) {
-        if (p.addr.client == a.client) {
-          foundPrimarySender = foundPrimarySender || p.primarySender;
-          foundPrimaryDest   = foundPrimaryDest   || p.primaryDest;
-        }
-        if (foundPrimarySender && foundPrimaryDest)
-          break;
-      }
-      address.primarySender = !foundPrimarySender && address.canBeSender();
-      address.primaryDest   = !foundPrimaryDest   && address.canBeDest();
+      // Compute primary port status. See comment in connection-logic.cpp
+      // for details about this computation. Ports are scanned in order,
+      // so the first of each client's that can be a sender is the primary
+      // sender, and likewise for dests.
+      auto& found = primariesFound[a.client];
+      address.primarySender = !found.sender && address.canBeSender();
+      address.primaryDest   = !found.dest   && address.canBeDest();
+      found.sender = found.sender || address.primarySender;
+      found.dest   = found.dest   || address.primaryDest;
 
       if (useLongPortNames)
         address.port = address.portLong;
@@ -93,6 +90,7 @@ void SeqSnapshot::refresh() {
     if (si != addrMap.end() && di != addrMap.end()) {
       Connection conn = {si->second, di->second};
       connections.push_back(conn);
+      connectionIndex.insert(c);
     }
   });
   std::sort(connections.begin(), connections.end(),
@@ -125,6 +123,9 @@ bool SeqSnapshot::checkIfNeedsRefresh() {
         break;
     }
 
+  if (seq.takeOverrun())
+    needsRefresh = true;
+
   return needsRefresh;
 }
 
@@ -143,10 +144,7 @@ bool SeqSnapshot::addressStillValid(const Address& priorA) const {
 bool SeqSnapshot::hasConnectionBetween(
   const Address& sender, const Address& dest) const
 {
-  return std::any_of(connections.begin(), connections.end(),
-    [&](const auto& c){
-      return c.sender.addr == sender.addr && c.dest.addr == dest.addr;
-     });
+  return connectionIndex.has({sender.addr, dest.addr});
 }
 
 const char* SeqSnapshot::dirStr(bool sender, bool dest) {
@@ -3,6 +3,7 @@
 #include <map>
 #include <set>
 
+#include "addrtables.h"
 #include "seq.h"
 
 struct SeqSnapshot {
@@ -27,6 +28,7 @@ struct SeqSnapshot {
   std::vector<Client> clients;
   std::vector<Address> ports;
   std::vector<Connection> connections;
+  ConnectionGraph connectionIndex;    // the same connections, by port
 
   std::string::size_type clientWidth = 0;
   std::string::size_type portWidth = 0;
@@ -3,6 +3,7 @@
 #include <iomanip>
 #include <sstream>
 
+#include "arena.h"
 #include "args-service.h"
 #include "files.h"
 #include "msg.h"
@@ -27,6 +28,7 @@ void MidiMinder::sendResetCommand() {
   IPC::Options opts;
   if (Args::keepObserved)   opts.push_back("keepObserved");
   if (Args::resetHard)      opts.push_back("resetHard");
+  if (Args::resetMinimal)   opts.push_back("resetMinimal");
   client.sendCommandAndOptions("reset", opts);
 }
 
@@ -35,9 +37,11 @@ void MidiMinder::handleResetCommand(
 {
   bool keepObserved = false;
   bool resetHard = false;
+  bool resetMinimal = false;
   for (auto& o : opts) {
     if (o == "keepObserved")          keepObserved = true;
     else if (o == "resetHard")        resetHard = true;
+    else if (o == "resetMinimal")     resetMinimal = true;
     else
       Msg::error("Option to reset command not recognized: {}, ignoring.", o);
   }
@@ -45,7 +49,15 @@ void MidiMinder::handleResetCommand(
   if (!keepObserved)
     clearObserved();
 
-  if (resetHard)
+  if (resetMinimal) {
+    // Always against what ALSA Seq has: the point is to leave alone the
+    // connections that are really there, not those the daemon thinks are.
+    auto r = reconcileWithSystem();
+    Msg::output("Reset avoided {} operations:"
+      " {} disconnects and {} connects were not needed.",
+      r.skipped(), r.disconnectsSkipped, r.connectsSkipped);
+  }
+  else if (resetHard)
     resetConnectionsHard();
   else
     resetConnectionsSoft();
@@ -85,7 +97,7 @@ void MidiMinder::handleLoadCommand(IPC::Connection& conn) {
       Msg::detail("    {}", r);
 
   clearObserved();
-  resetConnectionsSoft();
+  reconcileConnections();
 }
 
 void MidiMinder::sendSaveCommand() {
@@ -99,17 +111,20 @@ void MidiMinder::sendSaveCommand() {
 }
 
 void MidiMinder::handleSaveCommand(IPC::Connection& conn) {
+  flushObserved();    // so the state directory agrees with what is sent
+
   std::stringstream combinedProfile;
   if (!profileText.empty()) {
     combinedProfile << "# Profile rules:\n";
     combinedProfile << profileText;
 
   }
-  if (!observedText.empty()) {
+  if (!observedRules.empty()) {
     combinedProfile << "# Observed rules:\n";
-    combinedProfile << observedText;
+    for (auto& r : observedRules)     // the file may be behind, see RuleJournal
+      combinedProfile << r << '\n';
   }
-  if (profileText.empty() && observedText.empty()) {
+  if (profileText.empty() && observedRules.empty()) {
     combinedProfile << "# No rules defined.\n";
   }
 
@@ -118,18 +133,67 @@ void MidiMinder::handleSaveCommand(IPC::Connection& conn) {
 
 void MidiMinder::sendStatusCommand() {
   IPC::Client client;
-  client.sendCommand("status");
+  IPC::Options opts;
+  if (Args::statusLatency)  opts.push_back("latency");
+  client.sendCommandAndOptions("status", opts);
   client.receiveFile(std::cout);
 }
 
-void MidiMinder::handleStatusCommand(IPC::Connection& conn) {
+void MidiMinder::handleStatusCommand(
+  IPC::Connection& conn, const IPC::Options& opts)
+{
+  bool showLatency = false;
+  for (auto& o : opts) {
+    if (o == "latency")               showLatency = true;
+    else
+      Msg::error("Option to status command not recognized: {}, ignoring.", o);
+  }
+
   std::stringstream report;
+  if (showLatency) {
+    latency.report(report);
+    conn.sendFile(report);
+    return;
+  }
+
   auto w = std::setw(4);
   report << "Daemon is running.\n";
   report << w << profileRules.size()        << " profile rules.\n";
   report << w << observedRules.size()       << " observed rules.\n";
+  report << w << observedJournal.entries()
+    << " observed rule changes journaled, " << observedJournal.size()
+    << " bytes\n";
+  if (observedWrites.pending())
+    report << w << observedJournal.unflushed()
+      << " observed rule changes waiting to be written, for "
+      << observedWrites.waited().count() << "ms\n";
   report << w << activePorts.size()         << " active ports.\n";
   report << w << activeConnections.size()   << " active connections\n";
+
+  auto& dc = decisionCache;
+  auto lookups = dc.hits + dc.misses;
+  report << w << (lookups ? 100 * dc.hits / lookups : 0)
+    << "% rule decision cache hit rate ("
+    << dc.hits << " hits, " << dc.misses << " misses)\n";
+  report << w << seq.queriesSaved
+    << " ALSA queries answered from the address cache\n";
+  report << w << topologyCheck.checks << " topology checks, "
+    << topologyCheck.changes << " changed clients found\n";
+  if (reader.running())
+    report << w << reader.received << " events from the reader thread, "
+      << reader.dropped << " lost\n";
+  report << w << seq.overruns + reader.overruns
+    << " ALSA Seq input overruns, " << resyncs << " resyncs\n";
+#ifdef COUNT_ALLOCATIONS
+  report << w << allocatingPasses << " of " << passes
+    << " event loop passes allocated from the heap, "
+    << lastPassAllocations << " times in the last\n";
+#endif
+  auto& arena = scratchArena();
+  report << w << arena.highWater() / 1024 << "k scratch arena high water, "
+    << arena.capacity() / 1024 << "k reserved, "
+    << arena.overflows << " overflows\n";
+  latency.summary(report);
   conn.sendFile(report);
 }
 
@@ -143,15 +207,18 @@ void MidiMinder::handleConnection() {
     auto msg = conn.receiveCommandAndOptions();
     auto command = msg.first;
     auto& options = msg.second;
+    cause = Cause{command, Latency::Clock::now()};
 
     if      (command == "reset") handleResetCommand(conn, options);
     else if (command == "load")  handleLoadCommand(conn);
     else if (command == "save")  handleSaveCommand(conn);
-    else if (command == "status")  handleStatusCommand(conn);
+    else if (command == "status")  handleStatusCommand(conn, options);
     else
       Msg::error("Unrecognized user command \"{}\", ignoring.", command);
+    finishBatch();
   }
   catch (const IPC::SocketError& se) {
     Msg::error("Client connection failed: {}, ignoring", se.what());
+    cause.reset();
   }
 }
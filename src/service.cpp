@@ -2,96 +2,26 @@
 
 #include <algorithm>
 #include <csignal>
+#include <iterator>
 #include <sstream>
 #include <sys/epoll.h>
 
+#include <fmt/format.h>
+
+#ifdef COUNT_ALLOCATIONS
+#include "allocations.h"
+#endif
+#include "arena.h"
 #include "files.h"
+#include "args-service.h"
 #include "msg.h"
+#include "rulecache.h"
 
 
 namespace {
 
-  enum class RuleSource {
-    profile,
-    observed,
-  };
-
-  const char* ruleSourceName(RuleSource r) {
-    switch (r) {
-      case RuleSource::profile:    return "profile";
-      case RuleSource::observed:   return "observed";
-      default:                     return "???";
-    }
-  }
-
-
-  struct CandidateConnection {
-    const Address& sender;
-    const Address& dest;
-    const ConnectionRule& rule;
-    RuleSource source;
-  };
-
-  using CandidateConnections = std::vector<CandidateConnection>;
-  using ActivePorts = std::map<snd_seq_addr_t, Address>;
-
-  void considerConnection(
-    const Address& sender, const Address& dest,
-    const ConnectionRule& rule, RuleSource source, CandidateConnections& ccs)
-  {
-    if (!rule.isBlockingRule()) {
-      CandidateConnection cc = {sender, dest, rule, source};
-      ccs.push_back(cc);
-    }
-    else {
-      CandidateConnections filteredCCs;
-
-      for (auto& cc : ccs)
-        if (!rule.match(cc.sender, cc.dest))
-          filteredCCs.push_back(cc);
-
-      ccs.swap(filteredCCs);
-    }
-  }
-
-  void connectEachActiveSender(
-      const Address& a, const ConnectionRule& rule, RuleSource source,
-      const ActivePorts& activePorts, CandidateConnections& ccs)
-  {
-    for (auto& p : activePorts) {
-      auto& b = p.second;
-      if (b.canBeSender() && rule.senderMatch(b))
-        considerConnection(b, a, rule, source, ccs);
-    }
-  }
-
-  void connectEachActiveDest(
-      const Address& a, const ConnectionRule& rule, RuleSource source,
-      const ActivePorts& activePorts, CandidateConnections& ccs)
-  {
-    for (auto& p : activePorts) {
-      auto& b = p.second;
-      if (b.canBeDest() && rule.destMatch(b))
-        considerConnection(a, b, rule, source, ccs);
-    }
-  }
-
-  void connectByRule(const Address& a,
-    ConnectionRules& rules, RuleSource source,
-    const ActivePorts& activePorts, CandidateConnections& ccs) {
-    for (auto& rule : rules) {
-      if (a.canBeSender() && rule.senderMatch(a))
-        connectEachActiveDest(a, rule, source, activePorts, ccs);
-
-      if (a.canBeDest()   && rule.destMatch(a))
-        connectEachActiveSender(a, rule, source, activePorts, ccs);
-    }
-  }
-
-
-
-
   void readRules(const std::string& filePath,
+    const std::string& cachePath,
     std::string& contents,    // receives contents of the file
     ConnectionRules& rules)   // receives parsed rules
   {
@@ -105,7 +35,13 @@ namespace {
     std::string newContents = Files::readFile(filePath);
 
     ConnectionRules newRules;
-    if (!parseRules(newContents, newRules)) {
+    if (RuleCache::load(cachePath, filePath, newContents, newRules)) {
+      Msg::detail("Rules file {} unchanged, using {}", filePath, cachePath);
+    }
+    else if (parseRules(newContents, newRules)) {
+      RuleCache::save(cachePath, filePath, newContents, newRules);
+    }
+    else {
       Msg::error("Parse error reading rules file {}", filePath);
 
       std::string brokenPath = filePath + ".broken";
@@ -142,29 +78,14 @@ namespace {
         Msg::detail("    {}", r);
   }
 
-  enum class Found {
-    NoRule,
-    ConnectRule,
-    DisallowRule,
-  };
-
-  std::pair<Found, ConnectionRules::const_iterator>
-  findRule(const ConnectionRules& rules,
-    const Address& sender, const Address& dest)
-  {
-    auto r = std::find_if(rules.rbegin(), rules.rend(),
-      [&](const ConnectionRule& r){ return r.match(sender, dest); });
-    auto i = r == rules.rend() ? rules.end() : std::next(r).base();
-    auto f =
-      i == rules.end()
-        ? Found::NoRule
-        : (r->isBlockingRule() ? Found::DisallowRule: Found::ConnectRule);
-    return {f, i};
-  }
-
   enum class FDSource : uint32_t {
     Seq,
     Server,
+    PendingClients,
+    Subscriber,
+    TopologyCheck,
+    SeqReader,
+    ObservedWrites,
   };
 
   void addFDToEpoll(int epollFD, int fd, FDSource src) {
@@ -176,6 +97,27 @@ namespace {
       throw Msg::system_error("Failed adding to epoll");
   }
 
+  const char* eventName(snd_seq_event_type_t type) {
+    switch (type) {
+      case SND_SEQ_EVENT_CLIENT_START:      return "CLIENT_START";
+      case SND_SEQ_EVENT_CLIENT_EXIT:       return "CLIENT_EXIT";
+      case SND_SEQ_EVENT_CLIENT_CHANGE:     return "CLIENT_CHANGE";
+      case SND_SEQ_EVENT_PORT_START:        return "PORT_START";
+      case SND_SEQ_EVENT_PORT_EXIT:         return "PORT_EXIT";
+      case SND_SEQ_EVENT_PORT_CHANGE:       return "PORT_CHANGE";
+      case SND_SEQ_EVENT_PORT_SUBSCRIBED:   return "PORT_SUBSCRIBED";
+      case SND_SEQ_EVENT_PORT_UNSUBSCRIBED: return "PORT_UNSUBSCRIBED";
+      default:                              return "other event";
+    }
+  }
+
+  bool isUnnamedClient(const std::string& name) {
+    // The kernel assigns sprintf(..., "Client-%d", client_num) as the
+    // name of a new client.
+    return name.find("Client-", 0) == 0;
+      // Should use .starts_with(), but that is only in C++20
+  }
+
   volatile std::sig_atomic_t caughtSignal = 0;
 
   void signal_handler(int signal) {
@@ -192,10 +134,15 @@ MidiMinder::MidiMinder() {
   std::signal(SIGHUP, signal_handler);
   std::signal(SIGINT, signal_handler);
   std::signal(SIGTERM, signal_handler);
+  subscriber.begin(Args::subscribeThreads);
+    // before seq, so its clients aren't announced to us
   seq.begin("midiminder");
+  seq.setInputSize(Args::inputEvents);
+  portArrivals.reserve(64);   // enough for a hub full of devices at once
 }
 
 MidiMinder::~MidiMinder() {
+  subscriber.end();
   seq.end();
   std::signal(SIGHUP, SIG_DFL);
   std::signal(SIGINT, SIG_DFL);
@@ -203,16 +150,45 @@ MidiMinder::~MidiMinder() {
 }
 
 void MidiMinder::run() {
-  readRules(Files::profileFilePath(), profileText, profileRules);
-  readRules(Files::observedFilePath(), observedText, observedRules);
+  pendingClients.configure(
+    PendingClients::Duration(Args::nameRecheck),
+    PendingClients::Duration(Args::nameWait));
+  topologyCheck.configure(TopologyCheck::Duration(Args::checkInterval));
+  observedWrites.configure(
+    WriteBehind::Duration(Args::saveDelay),
+    WriteBehind::Duration(Args::saveDelay * 10));
+  if (Args::readerThread && reader.begin(Args::inputEvents))
+    seq.stopAnnouncements();  // the reader's client gets them now
+
+  readRules(Files::profileFilePath(), Files::profileCachePath(),
+    profileText, profileRules);
+  readRules(Files::observedFilePath(), Files::observedCachePath(),
+    observedText, observedRules);
+  if (auto n = observedJournal.open(
+      Files::observedJournalPath(), observedText, observedRules))
+    Msg::output("Journal {} replayed, {} changes, now {} observed rules.",
+      Files::observedJournalPath(), n, observedRules.size());
+  if (observedJournal.wantsCompaction())
+    saveObserved();
+  rulesChanged();
   resetConnectionsHard();
+  if (topologyCheck.enabled())
+    checkTopology();    // to have something to compare against
 
   int epollFD = epoll_create1(0);
   if (epollFD == -1)
     throw Msg::system_error("epoll_create failed");
 
-  seq.scanFDs([epollFD](int fd){ addFDToEpoll(epollFD, fd, FDSource::Seq); });
+  if (reader.running())
+    addFDToEpoll(epollFD, reader.fd(), FDSource::SeqReader);
+  else
+    seq.scanFDs([epollFD](int fd){ addFDToEpoll(epollFD, fd, FDSource::Seq); });
   server.scanFDs([epollFD](int fd){ addFDToEpoll(epollFD, fd, FDSource::Server); });
+  addFDToEpoll(epollFD, pendingClients.fd(), FDSource::PendingClients);
+  if (subscriber.enabled())
+    addFDToEpoll(epollFD, subscriber.fd(), FDSource::Subscriber);
+  addFDToEpoll(epollFD, topologyCheck.fd(), FDSource::TopologyCheck);
+  addFDToEpoll(epollFD, observedWrites.fd(), FDSource::ObservedWrites);
 
   while (true) {
     switch (caughtSignal) {
@@ -221,88 +197,162 @@ void MidiMinder::run() {
         auto s = caughtSignal;
         caughtSignal = 0;
         Msg::output("Reset requested by signal {}", s);
+        cause = Cause{"SIGHUP", Latency::Clock::now()};
         resetConnectionsHard();
+        finishBatch();
         break;
       }
       default:
         Msg::output("Exiting on signal {}", caughtSignal);
+        flushObserved();
         return;
     }
 
-    struct epoll_event evt;
-    int nfds = epoll_wait(epollFD, &evt, 1, -1);
+    struct epoll_event evts[8];
+    int nfds = epoll_wait(epollFD, evts, 8, -1);
     if (nfds == -1) {
       if (errno == EINTR) continue;   // this was a signal
       else                throw Msg::system_error("epoll_wait failed");
     }
-    if (nfds == 0)
-      continue;
+    // Without the reader thread, this is the earliest events read below
+    // can be known to have arrived.
+    auto woke = Latency::Clock::now();
+
+#ifdef COUNT_ALLOCATIONS
+    auto allocationsBefore = Allocations::count();
+#endif
+
+    for (int i = 0; i < nfds; ++i) {
+      switch ((FDSource)evts[i].data.u32) {
+        case FDSource::Server: {
+          handleConnection();
+          break;
+        }
+
+        case FDSource::Seq: {
+          // Plugging in a hub, or starting an application, announces many
+          // ports at once. Read all that are pending, then make their
+          // connections in one go.
+          while (snd_seq_event_t* ev = seq.eventInput())
+            handleSeqEvent(*ev, woke);
+          if (seq.takeOverrun())
+            resyncAfterLoss();
+          finishBatch();
+          break;
+        }
 
-    switch ((FDSource)evt.data.u32) {
-      case FDSource::Server: {
-        handleConnection();
-        break;
-      }
+        case FDSource::SeqReader: {
+          handleReaderEvents();
+          finishBatch();
+          break;
+        }
 
-      case FDSource::Seq: {
-        while (snd_seq_event_t* ev = seq.eventInput())
-          handleSeqEvent(*ev);
-        break;
-      }
+        case FDSource::PendingClients: {
+          handlePendingClients();
+          finishBatch();
+          break;
+        }
 
-      default:
-        // should never happen... but who cares if it does!
-        break;
+        case FDSource::Subscriber: {
+          handleSubscribeResults();
+          break;
+        }
+
+        case FDSource::TopologyCheck: {
+          cause = Cause{"topology check", Latency::Clock::now()};
+          checkTopology();
+          finishBatch();
+          break;
+        }
+
+        case FDSource::ObservedWrites: {
+          if (observedWrites.due())
+            flushObserved();
+          break;
+        }
+
+        default:
+          // should never happen... but who cares if it does!
+          break;
+      }
     }
+
+    if (observedWrites.pending() && !observedWrites.enabled())
+      flushObserved();
+
+    // Nothing from the scratch arena outlives the handling of the events.
+    scratchArena().reset();
+#ifdef COUNT_ALLOCATIONS
+    lastPassAllocations = Allocations::count() - allocationsBefore;
+    passes += 1;
+    if (lastPassAllocations)
+      allocatingPasses += 1;
+#endif
   }
 }
 
-void MidiMinder::handleSeqEvent(snd_seq_event_t& ev) {
+void MidiMinder::handleSeqEvent(
+  snd_seq_event_t& ev, Latency::Stamp received)
+{
   Msg::debug("ALSA Seq event: {}", ev);
+  fmt::memory_buffer what;
+  fmt::format_to(std::back_inserter(what), "{} handled", eventName(ev.type));
+  latency.record({what.data(), what.size()}, received);
 
   switch (ev.type) {
     case SND_SEQ_EVENT_CLIENT_START: {
-      std::string name = seq.clientName(ev.data.addr.client);
-      if (name.find("Client-", 0) == 0) {
-        // Should use .starts_with(), but that is only in C++20
-
-        // The kernel assigns sprintf(..., "Client-%d", client_num) as the
-        // name of a new client. Most clients immediately change the name to
-        // something more useful before doing anything else. Some
-        // applications (looking at you, PureData), create their ports first
-        // then set their client name. As a consequence, This code may see
-        // the PORT_START event from the port creation, before the client
-        // has changed its name.
-
-        // This is a cheap hack: If we learn about a client before it has
-        // changed its name, just sleep for a little bit, and it should be
-        // updated by the time we're back.
-
-        // Empirically, on a RPi4b, using PureData as the test app, 10ms
-        // wasn't enough, 25ms was. Using 100ms to be safe. We want this as
-        // low as reasonable to keep the code being responsive.
-        timespec nap = { 0, 100000 };
-        nanosleep(&nap, nullptr);
+      // Most clients immediately change their name to something more
+      // useful before doing anything else. Some applications (looking at
+      // you, PureData), create their ports first then set their client
+      // name. Rules match by name, so the ports of a client that hasn't
+      // set its name yet are held in pendingClients, until it does, or
+      // it has been long enough that it probably never will.
+      client_id_t c = ev.data.addr.client;
+      if (pendingClients.enabled() && isUnnamedClient(seq.clientName(c))) {
+        Msg::detail("Client {} has no name yet, holding its ports", c);
+        pendingClients.add(c);
       }
+      break;
     }
 
     case SND_SEQ_EVENT_CLIENT_EXIT:
-      // We will have received PORT_EXIT events for all ports, so there
-      // is nothing left to do here.
+      // We will have received PORT_EXIT events for all ports, so this
+      // normally only finds clients never named. Any ports still noted
+      // for it go too.
+      pendingClients.remove(ev.data.addr.client);
+      delClient(ev.data.addr.client);
       break;
 
-    case SND_SEQ_EVENT_CLIENT_CHANGE:
+    case SND_SEQ_EVENT_CLIENT_CHANGE: {
       // The kernel has a bug in that it never sends this event. If it did
       // this code should look to see if the name of the client has changed
       // and if so, remove and re-add all it's ports under the new name.
+      // It does at least serve to release a held client. Renames are
+      // otherwise caught by checkTopology().
+      client_id_t c = ev.data.addr.client;
+      if (pendingClients.has(c) && !isUnnamedClient(seq.clientName(c)))
+        releaseClient(c);
       break;
+    }
 
     case SND_SEQ_EVENT_PORT_START: {
-      addPort(ev.data.addr);
+      if (portArrivals.find(ev.data.addr) == portArrivals.end())
+        portArrivals[ev.data.addr] = received;
+      client_id_t c = ev.data.addr.client;
+      if (pendingClients.has(c)) {
+        if (isUnnamedClient(seq.clientName(c))) {
+          pendingClients.parkPort(ev.data.addr);
+          break;
+        }
+        releaseClient(c);
+      }
+      addPortToBatch(ev.data.addr);
       break;
     }
 
     case SND_SEQ_EVENT_PORT_EXIT: {
+      portArrivals.erase(ev.data.addr);
+      pendingClients.unparkPort(ev.data.addr);
       delPort(ev.data.addr);
       break;
     }
@@ -311,7 +361,7 @@ void MidiMinder::handleSeqEvent(snd_seq_event_t& ev) {
       // The kernel has a bug in that it doesn't send this event in most
       // cases. If it did, then this code should look to see if the name
       // or the capabilities we care about have changed, and if so, remove
-      // and re-add the port.
+      // and re-add the port. As it is, checkTopology() does this.
       break;
     }
 
@@ -332,276 +382,221 @@ void MidiMinder::handleSeqEvent(snd_seq_event_t& ev) {
   }
 }
 
+void MidiMinder::handleReaderEvents() {
+  snd_seq_event_t ev;
+  Latency::Stamp received;
+  while (reader.next(ev, received)) {
+    seq.forget(ev);
+    handleSeqEvent(ev, received);
+  }
 
-void MidiMinder::saveObserved() {
-  std::ostringstream text;
-  for (auto& r : observedRules)
-    text << r << '\n';
-  observedText = text.str();
-  Files::writeFile(Files::observedFilePath(), observedText);
-  Msg::debug("Observed rules written.");
+  bool overrun = reader.takeOverrun();
+  if (auto lost = reader.takeDropped())
+    Msg::error("Reader thread had no room for {} ALSA Seq events", lost);
+  else if (!overrun)
+    return;
+  resyncAfterLoss();
 }
 
-void MidiMinder::clearObserved() {
-  observedText.clear();
-  observedRules.clear();
-  saveObserved();
+void MidiMinder::resyncAfterLoss() {
+// some events were never seen, so catch up with what the system has now
+  Msg::error("Resyncing with ALSA Seq, after events were lost");
+  resyncs += 1;
+  eventsLost();
+  reconcileWithSystem();
 }
 
-void MidiMinder::resetConnectionsHard() {
-// reset ports & connections from scratch, rescanning ALSA Seq
-
-  std::vector<snd_seq_connect_t> doomed;
-  activeConnections.clear();
-    // a little afraid to disconnect connections while scanning them!
-  seq.scanConnections([&](auto c){
-    const Address& sender = seq.address(c.sender);
-    const Address& dest = seq.address(c.dest);
-    if (sender.mindable && dest.mindable)
-      // check if it's a connection we would manage
-      doomed.push_back(c);
-  });
-  for (auto& c : doomed) {
-    seq.disconnect(c);  // will generate UNSUB events that should be ignored
-    expectedDisconnects.insert(c);
-  }
+void MidiMinder::finishBatch() {
+  connectNewPorts();
 
-  activePorts.clear();
-  seq.scanPorts([&](auto p){
-    this->addPort(p, true);
-  });
+  // Ports still unknown are held, or aren't mindable.
+  portArrivals.eraseIf([&](auto& a){ return bool(knownPort(a.first)); });
+  cause.reset();
 }
 
-void MidiMinder::resetConnectionsSoft() {
-// reset ports & connections without rescanning ALSA Seq
-  std::set<snd_seq_connect_t> doomed;
-  doomed.swap(activeConnections);
-  for (auto& c : doomed) {
-    seq.disconnect(c);  // will generate UNSUB events that should be ignored
-    expectedDisconnects.insert(c);
+void MidiMinder::noteLatency(const char* op, const snd_seq_connect_t& conn) {
+  if (cause) {
+    fmt::memory_buffer what;
+    fmt::format_to(std::back_inserter(what), "{} to {}", cause->name, op);
+    latency.record({what.data(), what.size()}, cause->at);
+    return;
   }
 
-  std::map<snd_seq_addr_t, Address> ports;
-  ports.swap(activePorts);
-  for (auto& p: ports)
-    addPort(p.first, true); // does regenreate the Address from Seq::address()
+  auto s = portArrivals.find(conn.sender);
+  auto d = portArrivals.find(conn.dest);
+  if (s == portArrivals.end() && d == portArrivals.end())
+    return;
+
+  // the later of the two is the one that made the connection possible
+  Latency::Stamp arrived =
+    s == portArrivals.end() ? d->second
+    : d == portArrivals.end() ? s->second
+    : std::max(s->second, d->second);
+  fmt::memory_buffer what;
+  fmt::format_to(std::back_inserter(what), "PORT_START to {}", op);
+  latency.record({what.data(), what.size()}, arrived);
 }
 
 
-const Address& MidiMinder::knownPort(snd_seq_addr_t addr) {
-  const auto i = activePorts.find(addr);
-  if (i == activePorts.end()) return Address::null;
-  return i->second;
+void MidiMinder::saveObserved() {
+  fmt::memory_buffer text;
+  for (auto& r : observedRules)
+    fmt::format_to(std::back_inserter(text), "{}\n", r);
+  observedText.assign(text.data(), text.size());
+  Files::writeFile(Files::observedFilePath(), observedText);
+  observedJournal.restart(observedText);
+  observedWrites.written();
+  Msg::debug("Observed rules written.");
 }
 
+void MidiMinder::flushObserved() {
+// writes out the changes to the observed rules that are being held back
+  if (!observedWrites.pending())
+    return;
 
-// Note: The computation of primary port status assumes that
-// applications will create their ports from zero, in order,
-// and when they delete ports, they delete them all. All
-// applications we tested do this. Should an application
-// create ports with explicit port numbers out of order, or
-// delete low numbered ports, then recreate them... it
-// would logically cause the priamry port to jump around.
-// This code base doesn't handle that case, though invoking
-// the reset function will clear up any mess that was made.
-
-void MidiMinder::addPort(const snd_seq_addr_t& addr, bool fromReset ) {
-  if (knownPort(addr)) return;
-
-  Address a = seq.address(addr);
-  if (!a.mindable) return;
-
-  bool foundPrimarySender = false;
-  bool foundPrimaryDest = false;
-  for (const auto& i : activePorts) {
-    if (i.first.client == addr.client) {
-      foundPrimarySender = foundPrimarySender || i.second.primarySender;
-      foundPrimaryDest   = foundPrimaryDest   || i.second.primaryDest;
-    }
-    if (foundPrimarySender && foundPrimaryDest)
-      break;
-  }
-  if (a.canBeSender() && !foundPrimarySender)   a.primarySender = true;
-  if (a.canBeDest() && !foundPrimaryDest)       a.primaryDest = true;
-
-  activePorts[addr] = a;
-  Msg::output("{} port: {}", fromReset ? "Reviewing" : "System added", a);
-
-  CandidateConnections candidates;
-  connectByRule(a, profileRules, RuleSource::profile, activePorts, candidates);
-  connectByRule(a, observedRules, RuleSource::observed, activePorts, candidates);
-  for (auto& cc : candidates) {
-    snd_seq_connect_t conn = {cc.sender.addr, cc.dest.addr};
-    if (activeConnections.find(conn) == activeConnections.end()) {
-      seq.connect(conn.sender, conn.dest);
-      expectedConnects.insert(conn);
-      activeConnections.insert(conn);
-      Msg::output("Connecting {} --> {}\n    by {} rule: {}",
-        cc.sender, cc.dest, ruleSourceName(cc.source), cc.rule);
-    }
+  if (observedJournal.wantsCompaction()) {
+    saveObserved();
+    return;
   }
+  Msg::debug("Writing {} observed rule change(s), after {}ms",
+    observedJournal.unflushed(), observedWrites.waited().count());
+  observedJournal.flush();
+  observedWrites.written();
 }
 
-void MidiMinder::delPort(const snd_seq_addr_t& addr) {
-  const Address& port = knownPort(addr);
-  if (!port)
-    return;
+void MidiMinder::clearObserved() {
+  observedText.clear();
+  observedRules.clear();
+  saveObserved();
+  rulesChanged();
+}
+
+void MidiMinder::releaseClient(client_id_t c) {
+  auto ports = pendingClients.release(c);
+  Msg::detail("Client {} is now {}, releasing {} port(s)",
+    c, seq.clientName(c), ports.size());
+  for (auto& p : ports)
+    addPortToBatch(p);
+}
 
-  Msg::output("System removed port: {}", port);
+void MidiMinder::handlePendingClients() {
+  for (auto c : pendingClients.due()) {
+    if (isUnnamedClient(seq.clientName(c)) && pendingClients.recheckLater(c))
+      continue;
+    releaseClient(c);
+  }
+}
 
-  std::vector<snd_seq_connect_t> doomed;
-  for (auto& c : activeConnections) {
-    if (c.sender == addr || c.dest == addr) {
-      doomed.push_back(c);
+void MidiMinder::handleSubscribeResults() {
+  for (auto& r : subscriber.completed()) {
+    if (r.err >= 0) continue;
 
-      const Address& sender = knownPort(c.sender);
-      const Address& dest = knownPort(c.dest);
-      if (sender && dest)
-        Msg::detail("    disconnected {} --> {}", sender, dest);
+    // The kernel won't send an event for an operation that failed.
+    if (r.connect) {
+      expectedConnects.erase(r.conn);
+      if (r.err == -EBUSY) continue;  // connection is already made
+      activeConnections.erase(r.conn);
+      Msg::error("ALSA Seq error {} in subscribe {}", r.err, r.conn);
+    }
+    else {
+      expectedDisconnects.erase(r.conn);
+      if (r.err == -ENOENT) continue;  // connection not found
+      Msg::error("ALSA Seq error {} in unsubscribe {}", r.err, r.conn);
     }
   }
-
-  activePorts.erase(addr);
-  for (auto& d : doomed)
-    activeConnections.erase(d);
 }
 
+void MidiMinder::checkTopology() {
+  topologyCheck.begin();
+  seq.scanFingerprints([&](auto c, auto fingerprint, auto& ports){
+    if (!topologyCheck.update(c, fingerprint, ports))
+      return;
+    if (!seq.isMindableClient(c) || pendingClients.has(c))
+      return;   // held clients have their ports added when released
+
+    seq.forgetClient(c);
+    Msg::output("Client {} changed, reviewing its ports", seq.clientName(c));
+    std::vector<snd_seq_addr_t> addrs;
+    for (auto& p : ports)
+      addrs.push_back(p.addr);
+    reviewClient(c, addrs);
+  });
+  topologyCheck.end();
+}
 
-void MidiMinder::addConnection(const snd_seq_connect_t& conn) {
-  auto i = activeConnections.find(conn);
-  if (i != activeConnections.end())
-    // already know about this connection
-    return;
-
-  const Address& sender = knownPort(conn.sender);
-  const Address& dest = knownPort(conn.dest);
-  if (!sender || !dest)
-    return;
 
-  Msg::output("Observed connection: {} --> {}", sender, dest);
+Address MidiMinder::portAddress(const snd_seq_addr_t& addr) {
+  return seq.address(addr);
+}
 
-  activeConnections.insert(conn);
+void MidiMinder::connectPorts(const snd_seq_connect_t& conn) {
+  noteLatency("connect", conn);
+  if (subscriber.enabled())
+    subscriber.connect(conn);
+  else
+    seq.connect(conn.sender, conn.dest);
+}
 
-  auto [oFind, oRule] = findRule(observedRules, sender, dest);
-  auto [pFind, pRule] = findRule(profileRules, sender , dest);
+void MidiMinder::disconnectPorts(const snd_seq_connect_t& conn) {
+  noteLatency("disconnect", conn);
+  if (subscriber.enabled())
+    subscriber.disconnect(conn);
+  else
+    seq.disconnect(conn);
+}
 
-  bool removeObsRule = false;
-  bool addNewObsRule = false;
+void MidiMinder::observedRuleRemoved(
+  std::size_t index, const ConnectionRule& rule)
+{
+  observedJournal.removed(index, rule);
+  observedWrites.changed();
+}
 
-  switch (oFind) {
-    case Found::NoRule:
-      if (pFind == Found::ConnectRule)
-        Msg::output("    already have a profile rule {}", *pRule);
-      else
-        addNewObsRule = true;
-      break;
+void MidiMinder::observedRuleAdded(const ConnectionRule& rule) {
+  observedJournal.added(rule);
+  observedWrites.changed();
+}
 
-    case Found::ConnectRule:
-      Msg::output("    already have an observed rule {}", *oRule);
-      if (pFind == Found::ConnectRule) {
-        Msg::output("    removing, as also have a profile rule {}", *pRule);
-        removeObsRule = true;
-      }
-      break;
 
-    case Found::DisallowRule:
-      Msg::output("    removing observed disallow rule {}", *oRule);
-      removeObsRule = true;
-      switch (pFind) {
-        case Found::NoRule:
-          Msg::output("    no expected profile rule found");
-          addNewObsRule = true;
-          break;
-        case Found::ConnectRule:
-          break;
-        case Found::DisallowRule:
-          Msg::output("    also have a profile disallow rule {}", *pRule);
-          addNewObsRule = true;
-      }
-  }
-
-  if (removeObsRule)
-    observedRules.erase(oRule);
+void MidiMinder::resetConnectionsHard() {
+// reset ports & connections from scratch, rescanning ALSA Seq
 
-  if (addNewObsRule) {
-    ConnectionRule c = ConnectionRule::exact(sender, dest);
-    observedRules.push_back(c);
-    Msg::output("    adding observed rule {}", c);
+  std::vector<snd_seq_connect_t> doomed;
+  activeConnections.clear();
+    // a little afraid to disconnect connections while scanning them!
+  seq.scanConnections([&](auto c){
+    const Address& sender = seq.address(c.sender);
+    const Address& dest = seq.address(c.dest);
+    if (sender.mindable && dest.mindable)
+      // check if it's a connection we would manage
+      doomed.push_back(c);
+  });
+  for (auto& c : doomed) {
+    disconnectPorts(c); // will generate UNSUB events that should be ignored
+    expectedDisconnects.insert(c);
   }
 
-  if (removeObsRule || addNewObsRule)
-    saveObserved();
+  clearPorts();
+  seq.scanPorts([&](auto p){
+    this->addPort(p, true);
+  });
 }
 
-void MidiMinder::delConnection(const snd_seq_connect_t& conn) {
-  auto i = activeConnections.find(conn);
-  if (i == activeConnections.end())
-    // don't know anything about this connection
-    return;
-  activeConnections.erase(i);
-
-  const Address& sender = knownPort(conn.sender);
-  const Address& dest = knownPort(conn.dest);
-  if (!sender || !dest)
-    return;
-
-  Msg::output("Observed disconnection: {} --> {}", sender, dest);
+Reconciliation MidiMinder::reconcileWithSystem() {
+// like resetConnectionsHard(), rescanning ALSA Seq, but then only changes
+// those connections that differ from what the rules want
 
-  auto [oFind, oRule] = findRule(observedRules, sender, dest);
-  auto [pFind, pRule] = findRule(profileRules, sender , dest);
-
-  bool removeObsRule = false;
-  bool addNewObsRule = false;
-
-  switch (oFind) {
-    case Found::NoRule:
-      switch (pFind) {
-        case Found::NoRule:
-          Msg::output("    no rules found, doing nothing");
-          break;
-        case Found::ConnectRule:
-          addNewObsRule = true;
-          break;
-        case Found::DisallowRule:
-          Msg::output("    already have a profile rule {}", *pRule);
-          break;
-      }
-      break;
-
-    case Found::ConnectRule:
-      Msg::output("    removing observed rule {}", *oRule);
-      removeObsRule = true;
-      if (pFind == Found::ConnectRule) {
-        Msg::output("    also have a profile rule {}", *pRule);
-        addNewObsRule = true;
-      }
-      break;
-
-    case Found::DisallowRule:
-      Msg::output("    already have an observed rule {}", *oRule);
-      switch (pFind) {
-        case Found::NoRule:
-          Msg::output("    but no profile rule, so removing");
-          removeObsRule = true;
-          break;
-        case Found::ConnectRule:
-          break;
-        case Found::DisallowRule:
-          Msg::output("    removing, as also have a profile rule {}", *pRule);
-          removeObsRule = true;
-      }
-      break;
-  }
-
-  if (removeObsRule)
-    observedRules.erase(oRule);
+  clearPorts();
+  seq.scanPorts([&](auto p){
+    this->notePort(p, true);
+  });
 
-  if (addNewObsRule) {
-    ConnectionRule c = ConnectionRule::exactBlock(sender, dest);
-    observedRules.push_back(c);
-    Msg::output("    adding observed rule {}", c);
-  }
+  activeConnections.clear();
+  seq.scanConnections([&](auto c){
+    if (knownPort(c.sender) && knownPort(c.dest))
+      // it's a connection we would manage
+      activeConnections.insert(c);
+  });
 
-  if (removeObsRule || addNewObsRule)
-    saveObserved();
+  return updateConnections();
 }
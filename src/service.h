@@ -1,29 +1,45 @@
 #pragma once
 
 #include <map>
-#include <set>
+#include <optional>
 #include <string>
 
+#include "connection-logic.h"
 #include "ipc.h"
+#include "latency.h"
+#include "pendingclients.h"
 #include "rule.h"
+#include "rulejournal.h"
 #include "seq.h"
+#include "seqreader.h"
+#include "subscriber.h"
+#include "topologycheck.h"
+#include "writebehind.h"
 
-class MidiMinder {
+class MidiMinder : private ConnectionLogic {
   private:
     Seq seq;
     IPC::Server server;
 
-    ConnectionRules profileRules;
     std::string profileText;
-
-    ConnectionRules observedRules;
-    std::string observedText;
-
-    std::map<snd_seq_addr_t, Address> activePorts;
-    std::set<snd_seq_connect_t> activeConnections;
-
-    std::set<snd_seq_connect_t> expectedDisconnects;
-    std::set<snd_seq_connect_t> expectedConnects;
+    std::string observedText;     // as last read from, or written to, file
+    RuleJournal observedJournal;  // changes since then
+    WriteBehind observedWrites;   // paces writing those changes
+
+    PendingClients pendingClients;
+    Subscriber subscriber;
+    TopologyCheck topologyCheck;
+    SeqReader reader;
+
+    // Latency is measured from when an event or command was received, to
+    // the connects and disconnects that result.
+    Latency latency;
+    PortTable<Latency::Stamp> portArrivals;   // emptied after each batch
+    struct Cause {
+      std::string name;
+      Latency::Stamp at;
+    };
+    std::optional<Cause> cause;     // of the operations being made now
 
   public:
     MidiMinder();
@@ -32,28 +48,46 @@ class MidiMinder {
     void run();
 
   private:
-    void handleSeqEvent(snd_seq_event_t& ev);
+    void handleSeqEvent(snd_seq_event_t& ev, Latency::Stamp received);
+    void handleReaderEvents();
+    void finishBatch();
+    void resyncAfterLoss();
+    unsigned long resyncs = 0;
+    void noteLatency(const char* op, const snd_seq_connect_t&);
+    void releaseClient(client_id_t);
+    void handlePendingClients();
+    void handleSubscribeResults();
+    void checkTopology();
+
+#ifdef COUNT_ALLOCATIONS
+    // Heap allocations made in handling events, counted by pass through
+    // the event loop. Temporaries come from scratchArena(), and the tables
+    // keep their space, so a device plugged in again makes none. Passes
+    // still allocate for names not seen before, tables growing past their
+    // largest size yet, and rule sets of over 256 rules.
+    unsigned long passes = 0;
+    unsigned long allocatingPasses = 0;
+    unsigned long lastPassAllocations = 0;
+#endif
 
     void saveObserved();
+    void flushObserved();
     void clearObserved();
 
     void resetConnectionsHard();
-    void resetConnectionsSoft();
-
-
-    const Address& knownPort(snd_seq_addr_t addr);
-
-    void addPort(const snd_seq_addr_t& addr, bool fromReset = false);
-    void delPort(const snd_seq_addr_t& addr);
+    Reconciliation reconcileWithSystem();
 
-    void addConnection(const snd_seq_connect_t& conn);
-    void delConnection(const snd_seq_connect_t& conn);
+    Address portAddress(const snd_seq_addr_t&) override;
+    void connectPorts(const snd_seq_connect_t&) override;
+    void disconnectPorts(const snd_seq_connect_t&) override;
+    void observedRuleRemoved(std::size_t, const ConnectionRule&) override;
+    void observedRuleAdded(const ConnectionRule&) override;
 
   private:
     void handleResetCommand(IPC::Connection& conn, const IPC::Options& opts);
     void handleLoadCommand(IPC::Connection& conn);
     void handleSaveCommand(IPC::Connection& conn);
-    void handleStatusCommand(IPC::Connection& conn);
+    void handleStatusCommand(IPC::Connection& conn, const IPC::Options& opts);
 
     void handleConnection();
 
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+// A fixed size queue from one producing thread to one consuming thread,
+// without locks. Each index is only ever written by one side. push()
+// fails, rather than waits, when the ring is full.
+
+template <typename T, std::size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "size must be a power of two");
+
+  public:
+    bool push(const T& v) {   // producer only
+      auto t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) == N)
+        return false;
+      slots[t % N] = v;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(T& v) {          // consumer only
+      auto h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire))
+        return false;
+      v = slots[h % N];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::array<T, N> slots;
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
@@ -0,0 +1,127 @@
+#include "subscriber.h"
+
+#include <csignal>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "msg.h"
+
+
+Subscriber::Subscriber() {
+  eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFD < 0)
+    throw Msg::system_error("eventfd failed");
+}
+
+Subscriber::~Subscriber() {
+  end();
+  close(eventFD);
+}
+
+void Subscriber::begin(int threads) {
+  for (int i = 0; i < threads; ++i) {
+    auto w = std::make_unique<Worker>();
+
+    int serr = snd_seq_open(&w->seq, "default", SND_SEQ_OPEN_OUTPUT, 0);
+    if (serr < 0) {
+      Msg::error("ALSA Seq error {} in open sequencer for subscribing", serr);
+      break;
+    }
+    snd_seq_set_client_name(w->seq, "midiminder subscriber");
+
+    // Signals must go to the main thread, to interrupt its epoll_wait().
+    sigset_t all, prior;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &prior);
+
+    try {
+      w->thread = std::thread(&Subscriber::work, this, std::ref(*w));
+      pthread_sigmask(SIG_SETMASK, &prior, nullptr);
+    }
+    catch (const std::system_error& e) {
+      pthread_sigmask(SIG_SETMASK, &prior, nullptr);
+      // Most likely, the process limit: The shipped systemd unit has
+      // LimitNPROC=1.
+      Msg::error("Couldn't start subscribe thread: {}", e.what());
+      snd_seq_close(w->seq);
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    workers.push_back(std::move(w));
+  }
+
+  if (threads > 0)
+    Msg::detail("Subscribing with {} thread(s)", workers.size());
+}
+
+void Subscriber::end() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    for (auto& w : workers)
+      w->wake.notify_one();
+  }
+
+  for (auto& w : workers) {
+    w->thread.join();
+    snd_seq_close(w->seq);
+  }
+  workers.clear();
+  stopping = false;
+}
+
+void Subscriber::connect(const snd_seq_connect_t& conn) {
+  submit({conn, true});
+}
+
+void Subscriber::disconnect(const snd_seq_connect_t& conn) {
+  submit({conn, false});
+}
+
+std::vector<Subscriber::Result> Subscriber::completed() {
+  uint64_t count;
+  while (read(eventFD, &count, sizeof(count)) > 0)
+    ;   // just clearing the fd's readable state
+
+  std::vector<Result> done;
+  std::lock_guard<std::mutex> lock(mutex);
+  done.swap(results);
+  return done;
+}
+
+void Subscriber::submit(const Op& op) {
+  auto& s = op.conn.sender;
+  auto& d = op.conn.dest;
+  unsigned int h = (s.client << 24) ^ (s.port << 16) ^ (d.client << 8) ^ d.port;
+  h ^= h >> 13;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& w = *workers[h % workers.size()];
+  w.queue.push_back(op);
+  w.wake.notify_one();
+}
+
+void Subscriber::work(Worker& w) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    w.wake.wait(lock, [&]{ return stopping || !w.queue.empty(); });
+    if (w.queue.empty())
+      return;   // only when stopping
+
+    Op op = w.queue.front();
+    w.queue.pop_front();
+
+    lock.unlock();
+    int serr = op.connect
+      ? Seq::subscribe(w.seq, op.conn)
+      : Seq::unsubscribe(w.seq, op.conn);
+    lock.lock();
+
+    results.push_back({op.conn, op.connect, serr});
+    uint64_t one = 1;
+    auto n = write(eventFD, &one, sizeof(one));
+    (void)n;    // can only fail if the count would overflow
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "seq.h"
+
+
+// Makes and breaks connections in the background.
+//
+// Each subscribe or unsubscribe is a synchronous ioctl, and a hard reset
+// may issue hundreds of them. Here, they are queued, and carried out by a
+// small pool of threads, each with a sequencer handle of its own. The
+// outcomes come back to the event loop through an eventfd.
+//
+// Operations on the same connection always go to the same thread, so they
+// happen in the order they were queued.
+
+class Subscriber {
+  public:
+    struct Result {
+      snd_seq_connect_t conn;
+      bool connect;     // else, it was a disconnect
+      int err;          // as returned by ALSA
+    };
+
+    Subscriber();
+    ~Subscriber();
+
+    // Opens a handle and starts a thread for each of up to `threads`
+    // workers. If none could be started, enabled() is false, and the
+    // caller should make connections itself, as before.
+    void begin(int threads);
+    void end();     // finishes any queued operations first
+    bool enabled() const { return !workers.empty(); }
+
+    int fd() const { return eventFD; }
+
+    void connect(const snd_seq_connect_t&);
+    void disconnect(const snd_seq_connect_t&);
+
+    // Call when fd() is readable. Returns the outcomes since the last call.
+    std::vector<Result> completed();
+
+  private:
+    struct Op {
+      snd_seq_connect_t conn;
+      bool connect;
+    };
+
+    struct Worker {
+      snd_seq_t* seq = nullptr;
+      std::thread thread;
+      std::deque<Op> queue;
+      std::condition_variable wake;
+    };
+
+    int eventFD;
+
+    std::mutex mutex;     // guards everything below
+    bool stopping = false;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<Result> results;
+
+    void submit(const Op&);
+    void work(Worker&);
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+};
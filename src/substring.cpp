@@ -0,0 +1,84 @@
+#include "substring.h"
+
+#include <algorithm>
+#include <queue>
+
+
+SubstringMatcher::SubstringMatcher() : nodes(1) { }
+
+int SubstringMatcher::child(int node, unsigned char c) const {
+  auto& cs = nodes[node].children;
+  auto i = std::lower_bound(cs.begin(), cs.end(), c,
+    [](const auto& p, unsigned char c){ return p.first < c; });
+  return (i != cs.end() && i->first == c) ? i->second : -1;
+}
+
+std::size_t SubstringMatcher::add(const std::string& s) {
+  int n = 0;
+  for (unsigned char c : s) {
+    int next = child(n, c);
+    if (next < 0) {
+      next = nodes.size();
+      auto& cs = nodes[n].children;
+      auto i = std::lower_bound(cs.begin(), cs.end(), c,
+        [](const auto& p, unsigned char c){ return p.first < c; });
+      cs.insert(i, {c, next});
+      nodes.emplace_back();   // invalidates cs, so must come last
+    }
+    n = next;
+  }
+
+  if (nodes[n].substring < 0) {
+    nodes[n].substring = substrings.size();
+    substrings.push_back(s);
+  }
+  return nodes[n].substring;
+}
+
+void SubstringMatcher::build() {
+  // Breadth first, so that every node's suffix is computed before its
+  // children need it.
+
+  std::queue<int> queue;
+  for (auto& c : nodes[0].children) {
+    nodes[c.second].suffix = 0;
+    queue.push(c.second);
+  }
+  nodes[0].output = nodes[0].substring >= 0 ? 0 : -1;
+
+  while (!queue.empty()) {
+    int n = queue.front();
+    queue.pop();
+
+    auto& node = nodes[n];
+    node.output = node.substring >= 0 ? n : nodes[node.suffix].output;
+
+    for (auto& c : node.children) {
+      int f = node.suffix;
+      int g;
+      while ((g = child(f, c.first)) < 0 && f != 0)
+        f = nodes[f].suffix;
+      nodes[c.second].suffix = (g >= 0 && g != c.second) ? g : 0;
+      queue.push(c.second);
+    }
+  }
+}
+
+void SubstringMatcher::scan(
+    const std::string& text, ScratchVector<bool>& found) const
+{
+  // The empty string, if it was added, is in everything.
+  if (nodes[0].substring >= 0)
+    found[nodes[0].substring] = true;
+
+  int n = 0;
+  for (unsigned char c : text) {
+    int next;
+    while ((next = child(n, c)) < 0 && n != 0)
+      n = nodes[n].suffix;
+    n = next < 0 ? 0 : next;
+
+    for (int o = nodes[n].output; o > 0; o = nodes[nodes[o].suffix].output)
+      found[nodes[o].substring] = true;
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+
+
+// Finds which of a set of substrings occur in a string, in a single pass
+// over the string. This is an Aho-Corasick automaton: a trie of the
+// substrings, with each node linked to the node for its longest proper
+// suffix that is also in the trie.
+
+class SubstringMatcher {
+  public:
+    SubstringMatcher();
+
+    // Adds a substring, returning its id. Adding the same string more
+    // than once returns the same id.
+    std::size_t add(const std::string&);
+
+    // Must be called after all substrings are added, and before scan().
+    void build();
+
+    std::size_t size() const { return substrings.size(); }
+
+    // Sets found[id] for each substring that occurs in the text.
+    // found must already be sized to size().
+    void scan(const std::string& text, ScratchVector<bool>& found) const;
+
+  private:
+    struct Node {
+      std::vector<std::pair<unsigned char, int>> children; // sorted by char
+      int suffix = 0;       // longest proper suffix in the trie
+      int output = -1;      // nearest suffix (incl. this) that ends a substring
+      int substring = -1;   // id of the substring ending here, if any
+    };
+
+    std::vector<Node> nodes;
+    std::vector<std::string> substrings;
+
+    int child(int node, unsigned char c) const;
+};
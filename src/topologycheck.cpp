@@ -0,0 +1,81 @@
+#include "topologycheck.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "msg.h"
+
+
+TopologyCheck::TopologyCheck()
+  : interval(0)
+{
+  timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFD < 0)
+    throw Msg::system_error("timerfd_create failed");
+}
+
+TopologyCheck::~TopologyCheck() {
+  close(timerFD);
+}
+
+void TopologyCheck::configure(Duration i) {
+  interval = i;
+
+  struct itimerspec spec = { };   // all zero disarms the timer
+  spec.it_value.tv_sec = interval.count();
+  spec.it_interval.tv_sec = interval.count();
+
+  if (timerfd_settime(timerFD, 0, &spec, nullptr) != 0)
+    throw Msg::system_error("timerfd_settime failed");
+}
+
+void TopologyCheck::begin() {
+  uint64_t expirations;
+  while (read(timerFD, &expirations, sizeof(expirations)) > 0)
+    ;   // just clearing the fd's readable state
+
+  checks += 1;
+}
+
+bool TopologyCheck::update(client_id_t c, Seq::Fingerprint fingerprint,
+  const std::vector<Seq::PortFingerprint>& ports)
+{
+  auto i = clients.find(c);
+  if (i == clients.end()) {
+    // A new client: Its ports arrive through the usual events.
+    clients[c] = { fingerprint, ports, checks };
+    return false;
+  }
+
+  auto& seen = i->second;
+  bool changed = seen.fingerprint != fingerprint;
+
+  // Both lists are in port order: Compare the ports that are in both.
+  auto a = seen.ports.begin();
+  auto b = ports.begin();
+  while (!changed && a != seen.ports.end() && b != ports.end()) {
+    if (a->addr.port < b->addr.port)        ++a;
+    else if (b->addr.port < a->addr.port)   ++b;
+    else {
+      changed = a->fingerprint != b->fingerprint;
+      ++a;
+      ++b;
+    }
+  }
+
+  seen.fingerprint = fingerprint;
+  seen.ports = ports;
+  seen.check = checks;
+  if (changed)
+    changes += 1;
+  return changed;
+}
+
+void TopologyCheck::end() {
+  for (auto i = clients.begin(); i != clients.end(); ) {
+    if (i->second.check != checks)
+      i = clients.erase(i);
+    else
+      ++i;
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "seq.h"
+
+
+// Periodic check for clients and ports that changed without saying so.
+//
+// The kernel never sends CLIENT_CHANGE, and rarely PORT_CHANGE, so a
+// renamed client or port would otherwise never be matched against the
+// rules again. A full rescan is too costly to do often, so instead, each
+// check walks the client and port tables and reduces each client to
+// fingerprints: a hash of its name, and for each port, a hash of the port's
+// name, capabilities and types. Only clients whose name, or one of whose
+// ports, differs from the last check need any further work.
+//
+// Ports that came or went since the last check are not changes: The
+// kernel announces those, and the daemon has already dealt with them.
+//
+// The checks are paced by a timerfd, so it can sit in the daemon's epoll
+// set.
+
+class TopologyCheck {
+  public:
+    using Duration = std::chrono::seconds;
+
+    TopologyCheck();
+    ~TopologyCheck();
+
+    void configure(Duration interval);    // zero means never check
+    bool enabled() const { return interval.count() > 0; }
+
+    int fd() const { return timerFD; }
+
+    // Call when fd() is readable, then update() each client, then end().
+    void begin();
+    bool update(client_id_t, Seq::Fingerprint,
+      const std::vector<Seq::PortFingerprint>&);
+      // true if the client was seen before, and it, or a port it had then
+      // and still has, has a different fingerprint
+    void end();   // forgets clients that weren't updated
+
+    unsigned long checks = 0;
+    unsigned long changes = 0;
+
+  private:
+    struct Seen {
+      Seq::Fingerprint fingerprint;
+      std::vector<Seq::PortFingerprint> ports;    // in port order
+      unsigned long check;
+    };
+
+    int timerFD;
+    Duration interval;
+    std::map<client_id_t, Seen> clients;
+
+    TopologyCheck(const TopologyCheck&) = delete;
+    TopologyCheck& operator=(const TopologyCheck&) = delete;
+};
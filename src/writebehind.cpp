@@ -0,0 +1,86 @@
+#include "writebehind.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "msg.h"
+
+
+WriteBehind::WriteBehind()
+  : quiet(0), longest(0)
+{
+  timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFD < 0)
+    throw Msg::system_error("timerfd_create failed");
+}
+
+WriteBehind::~WriteBehind() {
+  close(timerFD);
+}
+
+void WriteBehind::configure(Duration q, Duration l) {
+  quiet = q;
+  longest = std::max(q, l);
+}
+
+void WriteBehind::changed() {
+  last = Clock::now();
+  if (waiting)
+    return;   // the timer is already set, due() will look at last
+
+  waiting = true;
+  first = last;
+  if (enabled())
+    arm(deadline());
+}
+
+WriteBehind::Duration WriteBehind::waited() const {
+  if (!waiting) return Duration::zero();
+  return std::chrono::duration_cast<Duration>(Clock::now() - first);
+}
+
+bool WriteBehind::due() {
+  uint64_t expirations;
+  while (read(timerFD, &expirations, sizeof(expirations)) > 0)
+    ;   // just clearing the fd's readable state
+
+  if (!waiting)
+    return false;
+
+  // More changes may have come since the timer was set.
+  auto when = deadline();
+  if (Clock::now() < when) {
+    arm(when);
+    return false;
+  }
+  return true;
+}
+
+void WriteBehind::written() {
+  if (!waiting)
+    return;
+  waiting = false;
+  if (enabled())
+    arm(Clock::time_point());
+}
+
+WriteBehind::Clock::time_point WriteBehind::deadline() const {
+  return std::min(last + quiet, first + longest);
+}
+
+void WriteBehind::arm(Clock::time_point when) {
+  struct itimerspec spec = { };   // all zero disarms the timer
+
+  if (when != Clock::time_point()) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      when.time_since_epoch()).count();
+    if (ns <= 0) ns = 1;    // zero would disarm
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+  }
+
+  if (timerfd_settime(timerFD, TFD_TIMER_ABSTIME, &spec, nullptr) != 0)
+    throw Msg::system_error("timerfd_settime failed");
+}
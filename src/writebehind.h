@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+
+
+// Pacing for writing out state that changes in bursts.
+//
+// A patchbay application, or a script, may make dozens of connections in a
+// row, each of which changes the observed rules. Rather than write each
+// change as it happens, the changes are held until there has been a quiet
+// period with no more, or until the first of them has waited the longest
+// it should, whichever comes first. The timer is a timerfd, so it can sit
+// in the daemon's epoll set.
+
+class WriteBehind {
+  public:
+    using Duration = std::chrono::milliseconds;
+
+    WriteBehind();
+    ~WriteBehind();
+
+    // A quiet period of zero means changes are written as soon as the
+    // event that made them has been handled.
+    void configure(Duration quiet, Duration longest);
+    bool enabled() const { return quiet.count() > 0; }
+
+    int fd() const { return timerFD; }
+
+    void changed();       // there is something to write
+    bool pending() const { return waiting; }
+    Duration waited() const;  // since the first change not yet written
+
+    // Call when fd() is readable. Returns true if it is time to write.
+    bool due();
+    void written();
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    int timerFD;
+    Duration quiet;
+    Duration longest;
+
+    bool waiting = false;
+    Clock::time_point first;
+    Clock::time_point last;
+
+    Clock::time_point deadline() const;
+    void arm(Clock::time_point);
+
+    WriteBehind(const WriteBehind&) = delete;
+    WriteBehind& operator=(const WriteBehind&) = delete;
+};